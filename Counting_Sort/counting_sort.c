@@ -3,7 +3,9 @@
  * Author: Naga Kandasamy
  * Date created: February 24, 2020
  * 
- * Compile as follows: gcc -o counting_sort counting_sort.c -std=c99 -Wall -O3 -lpthread -lm -D_GNU_SOURCE
+ * Compile as follows: gcc -o counting_sort counting_sort.c sorter.c -std=c99 -Wall -O3 -lpthread -lm -D_GNU_SOURCE
+ * or, against the library built as described in sorter.h:
+ *                     gcc -o counting_sort counting_sort.c -std=c99 -Wall -O3 -D_GNU_SOURCE -L. -lsorter -lpthread -lm
  */
 
 #include <stdlib.h>
@@ -15,41 +17,107 @@
 #include <limits.h>
 #include <malloc.h>
 #include <pthread.h>
-
-typedef struct args_for_thread_t {
-    int tid;                            /* The thread ID */
-    int num_threads;                    /* Number of worker threads */
-    int offset;                         /* Starting offset for thread within the vectors */
-    int chunk_size;                     /* Chunk size */
-    int num_elements;                   /* shared number of elements */
-    pthread_mutex_t *mutex_for_hist;    /* Location of the lock variable protecting sum */
-    int *input_array;
-    int range;
-    int *global_bin;
-    int *tbin;
-    int *sorted;
-    int *idx;
-
-} ARGS_FOR_THREAD;
-
-pthread_barrier_t barrier;
-pthread_barrier_t barrier2; 
-
-
-/* Do not change the range value. */
+#include <semaphore.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "sorter.h"
+
+/* On-disk key file: a 64-byte header followed by num_elements raw keys of 
+ * key_bytes bytes each, native byte order. 1- and 2-byte keys are unsigned, 
+ * 4-byte keys are signed ints. */
+#define KEY_FILE_MAGIC "CSORTKEY"
+
+typedef struct key_file_header_t {
+    char magic[8];                      /* KEY_FILE_MAGIC, without the terminating NUL */
+    uint32_t key_bytes;                 /* Width of each key: 1, 2 or 4 */
+    uint32_t reserved;
+    int64_t min_value;                  /* Every key lies in [min_value, max_value] */
+    int64_t max_value;
+    uint64_t num_elements;              /* Number of keys following the header */
+    uint8_t pad[24];                    /* Keeps the keys cache-line aligned */
+} KEY_FILE_HEADER;
+
+/* Summary of the timed repetitions of one benchmark configuration */
+typedef struct bench_result_t {
+    double min;                         /* Seconds */
+    double median;
+    double p95;
+} BENCH_RESULT;
+
+/* Phases timed by each process of the multi-process sort */
+#define DIST_COUNT  0
+#define DIST_REDUCE 1
+#define DIST_PREFIX 2
+#define DIST_FILL   3
+#define NUM_DIST_PHASES 4
+
+/* Multi-process sort, placed at the start of an anonymous shared mapping that 
+ * every process inherits across fork (). The pointers lead into the same 
+ * mapping, which is at the same address in all of them. */
+typedef struct dist_job_t {
+    pthread_barrier_t barrier;          /* Process-shared */
+    int num_procs;
+    int num_elements;
+    int min_value;
+    int num_bins;
+    int stride;                         /* Padded row length in ints */
+    FILL_KERNEL fill_kernel;
+    double *phase_time;                 /* NUM_DIST_PHASES seconds per process */
+    int *block_sum;                     /* Keys in each process's bin range */
+    int *local_bin;                     /* One histogram row per process */
+    int *global_bin;                    /* All-reduced histogram */
+    int *sorted;                        /* Output */
+} DIST_JOB;
+
+/* Default range of key values; override with -r min:max. */
 #define MIN_VALUE 0 
 #define MAX_VALUE 1023
 
+/* Default untimed and timed runs per configuration for -b sweep */
+#define BENCH_WARMUP 2
+#define BENCH_REPETITIONS 10
+
+/* Slice size in keys when -l materializes a run-length view */
+#define RUN_SLICE 4096
+
 /* Comment out if you don't need debug info */
 //#define DEBUG
 // #define DEBUG_MORE_VERBOSE
 
-int compute_gold (int *, int *, int, int);
-int rand_int (int, int);
 void print_array (int *, int);
 void print_min_and_max_in_array (int *, int);
-void compute_using_pthreads (int *, int *, int, int, int);
-void *thread_sort(void*);
+void distributed_worker (DIST_JOB *, int, const int *);
+int run_distributed_sort (int *, int *, int, int, int, int);
+int run_run_length_sort (int *, int *, int, int, int, int, int);
+int run_incremental_sort (int *, int, int, int, int, int, int, uint64_t);
+int run_profiled_sort (const char *, int *, int *, int, int, int, int, int);
+void benchmark_histogram (int, int, uint64_t);
+void benchmark_sharded (int, int, int, int, int, uint64_t);
+int compare_doubles (const void *, const void *);
+void summarize_samples (double *, int, BENCH_RESULT *);
+void print_bench_result (FILE *, int, int, const char *, int, int, const BENCH_RESULT *, double);
+void benchmark_sweep (int, int, int, int, int, uint64_t, FILE *);
+int run_typed_sort (const char *, int *, int *, int, int, int);
+int run_pair_sort (const char *, int *, int *, int, int, int, int);
+int run_radix_sort (int, int, int, int, int, int, uint64_t);
+void *stream_reader (void *);
+int run_streaming_sort (const char *, const char *, int, int, int, int);
+KEY_FILE_HEADER *map_key_file (const char *, int, size_t *);
+int write_key_file (const char *, int, int, int, int, uint64_t);
+int key_file_in_range (const KEY_FILE_HEADER *);
+int sort_key_file (const char *, const char *, int);
+int compare_u32 (const void *, const void *);
+int run_adaptive_sort (int *, int *, int, int, int);
+int compare_u64 (const void *, const void *);
+void print_usage (const char *);
 int check_if_sorted (int *, int);
 int compare_results (int *, int *, int);
 void print_histogram (int *, int, int);
@@ -57,31 +125,234 @@ void print_histogram (int *, int, int);
 int 
 main (int argc, char **argv)
 {
-    if (argc != 3) {
-        printf ("Usage: %s num-elements num-threads\n", argv[0]);
+    char *benchmark = NULL;
+    char *key_type = NULL;
+    char *payload_layout = NULL;
+    char *profile_mode = NULL;
+    int adaptive = 0;
+    int batch_size = 0;
+    int run_length = 0;
+    int num_procs = 0;
+    int radix_bits = 0;
+    char *stream_input = NULL;
+    char *output_path = NULL;
+    char *key_file = NULL;
+    char *new_key_file = NULL;
+    int range_given = 0;
+    int distribution = DIST_UNIFORM;
+    char *distribution_name = "uniform";
+    double zipf_exponent = ZIPF_EXPONENT;
+    uint64_t seed = (uint64_t) time (NULL);
+    int num_warmup = BENCH_WARMUP;
+    int num_repetitions = BENCH_REPETITIONS;
+    char *format = "csv";
+    int min_value = MIN_VALUE;
+    int max_value = MAX_VALUE;
+    int opt;
+    while ((opt = getopt (argc, argv, "ab:d:D:f:F:k:lN:o:p:P:r:R:s:S:u:w:W:")) != -1) {
+        switch (opt) {
+            case 'a':
+                adaptive = 1;
+                break;
+            case 'b':
+                benchmark = optarg;
+                break;
+            case 'k':
+                key_type = optarg;
+                break;
+            case 'p':
+                payload_layout = optarg;
+                break;
+            case 'P':
+                profile_mode = optarg;
+                break;
+            case 'u':
+                batch_size = atoi (optarg);
+                break;
+            case 'l':
+                run_length = 1;
+                break;
+            case 'D':
+                num_procs = atoi (optarg);
+                break;
+            case 'r':
+                if (sscanf (optarg, "%d:%d", &min_value, &max_value) != 2 || max_value < min_value) {
+                    printf ("Invalid key range %s\n", optarg);
+                    exit (EXIT_FAILURE);
+                }
+                range_given = 1;
+                break;
+            case 'R':
+                radix_bits = atoi (optarg);
+                break;
+            case 'S':
+                stream_input = optarg;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'F':
+                key_file = optarg;
+                break;
+            case 'w':
+                new_key_file = optarg;
+                break;
+            case 'd':
+                distribution_name = optarg;
+                distribution = parse_distribution (optarg, &zipf_exponent);
+                if (distribution < 0) {
+                    printf ("Unknown distribution %s\n", optarg);
+                    exit (EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                seed = strtoull (optarg, NULL, 0);
+                break;
+            case 'N':
+                num_repetitions = atoi (optarg);
+                break;
+            case 'W':
+                num_warmup = atoi (optarg);
+                break;
+            case 'f':
+                format = optarg;
+                break;
+            default:
+                print_usage (argv[0]);
+                exit (EXIT_FAILURE);
+        }
+    }
+
+    /* Recalibrate the adaptive sort's tuning cache; takes no arguments */
+    if (benchmark != NULL && strcmp (benchmark, "calibrate") == 0) {
+        char buffer[PATH_MAX];
+        const char *path = tuning_path (buffer, sizeof (buffer));
+        TUNING tuning;
+        if (!calibrate_tuning (&tuning)) {
+            printf ("Cannot calibrate: %s\n", strerror (errno));
+            exit (EXIT_FAILURE);
+        }
+        print_tuning (stdout, &tuning);
+        if (!save_tuning (path, &tuning)) {
+            perror (path);
+            exit (EXIT_FAILURE);
+        }
+        printf ("Saved to %s\n", path);
+        exit (EXIT_SUCCESS);
+    }
+
+    /* Sort a key file; the only argument is the number of threads */
+    if (key_file != NULL) {
+        if (argc - optind != 1 || atoi (argv[optind]) <= 0) {
+            print_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+        if (sort_key_file (key_file, output_path, atoi (argv[optind])) == 1)
+            exit (EXIT_SUCCESS);
         exit (EXIT_FAILURE);
     }
 
-    int num_elements = atoi (argv[1]);
-    int num_threads = atoi (argv[2]);
+    /* Write a key file of random keys; the only argument is the number of keys */
+    if (new_key_file != NULL) {
+        if (argc - optind != 1) {
+            print_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+        int key_bytes = 4;
+        if (key_type != NULL && strcmp (key_type, "u8") == 0)
+            key_bytes = 1;
+        else if (key_type != NULL && strcmp (key_type, "u16") == 0)
+            key_bytes = 2;
+        if (write_key_file (new_key_file, key_bytes, atoi (argv[optind]), min_value, max_value, seed) == 1)
+            exit (EXIT_SUCCESS);
+        exit (EXIT_FAILURE);
+    }
+
+    if (argc - optind != 2) {
+        print_usage (argv[0]);
+        exit (EXIT_FAILURE);
+    }
+
+    int num_elements = atoi (argv[optind]);
+    int num_threads = atoi (argv[optind + 1]);
+    if (num_threads <= 0) {
+        print_usage (argv[0]);
+        exit (EXIT_FAILURE);
+    }
+
+    if (benchmark != NULL) {
+        if (strcmp (benchmark, "histogram") == 0) {
+            benchmark_histogram (num_elements, num_threads, seed);
+            exit (EXIT_SUCCESS);
+        }
+        if (strcmp (benchmark, "sharded") == 0) {
+            if (num_elements <= 0 || num_repetitions <= 0) {
+                print_usage (argv[0]);
+                exit (EXIT_FAILURE);
+            }
+            benchmark_sharded (num_elements, num_threads, min_value, max_value, num_repetitions, seed);
+            exit (EXIT_SUCCESS);
+        }
+        if (strcmp (benchmark, "sweep") == 0) {
+            if (num_elements <= 0 || num_repetitions <= 0 || num_warmup < 0
+                || (strcmp (format, "csv") != 0 && strcmp (format, "json") != 0)) {
+                print_usage (argv[0]);
+                exit (EXIT_FAILURE);
+            }
+            FILE *out = (output_path != NULL) ? fopen (output_path, "w") : stdout;
+            if (out == NULL) {
+                perror (output_path);
+                exit (EXIT_FAILURE);
+            }
+            benchmark_sweep (num_elements, num_threads, num_warmup, num_repetitions,
+                             strcmp (format, "json") == 0, seed, out);
+            if (out != stdout)
+                fclose (out);
+            exit (EXIT_SUCCESS);
+        }
+        printf ("Unknown benchmark %s\n", benchmark);
+        exit (EXIT_FAILURE);
+    }
+
+    /* Streaming sort; the first argument is the chunk size rather than the input size */
+    if (stream_input != NULL) {
+        if (num_elements <= 0) {
+            print_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+        if (run_streaming_sort (stream_input, (output_path != NULL) ? output_path : "-", num_elements, num_threads, min_value, max_value) == 1)
+            exit (EXIT_SUCCESS);
+        exit (EXIT_FAILURE);
+    }
+
+    /* Radix sort of full-width keys, checked against qsort () */
+    if (radix_bits != 0) {
+        printf ("Sorting %d %d-bit keys using radix sort\n", num_elements, radix_bits);
+        if (run_radix_sort (radix_bits, num_elements, num_threads, !range_given, min_value, max_value, seed) == 1) {
+            printf ("Test passed\n");
+            exit (EXIT_SUCCESS);
+        }
+        printf ("Test failed\n");
+        exit (EXIT_FAILURE);
+    }
 
-    int range = MAX_VALUE - MIN_VALUE;
     int *input_array, *sorted_array_reference, *sorted_array_d;
 
     /* Store Execution Times */
     double s_time = 0;
     double p_time = 0;
 
-    /* Populate the input array with random integers between [0, RANGE]. */
-    printf ("Generating input array with %d elements in the range 0 to %d\n", num_elements, range);
+    /* Populate the input array with random integers between [min_value, max_value]. */
+    printf ("Generating input array with %d elements in the range %d to %d (%s, seed %llu)\n",
+            num_elements, min_value, max_value, distribution_name, (unsigned long long) seed);
     input_array = (int *) malloc (num_elements * sizeof (int));
     if (input_array == NULL) {
         printf ("Cannot malloc memory for the input array. \n");
         exit (EXIT_FAILURE);
     }
-    srand (time (NULL));
-    for (int i = 0; i < num_elements; i++)
-        input_array[i] = rand_int (MIN_VALUE, MAX_VALUE);
+    if (generate_input (input_array, num_elements, min_value, max_value,
+                        distribution, zipf_exponent, seed, num_threads) == 0)
+        exit (EXIT_FAILURE);
 
 #ifdef DEBUG
     print_array (input_array, num_elements);
@@ -97,11 +368,11 @@ main (int argc, char **argv)
         perror ("Malloc"); 
         exit (EXIT_FAILURE);
     }
-    memset (sorted_array_reference, 0, num_elements);
+    memset (sorted_array_reference, 0, num_elements * sizeof (int));
 
     struct timeval start, stop;	// Structure for times
 	gettimeofday (&start, NULL);
-    status = compute_gold (input_array, sorted_array_reference, num_elements, range);
+    status = compute_gold (input_array, sorted_array_reference, num_elements, min_value, max_value);
     if (status == 0) {
         exit (EXIT_FAILURE);
     }
@@ -128,9 +399,12 @@ main (int argc, char **argv)
         perror ("Malloc");
         exit (EXIT_FAILURE);
     }
-    memset (sorted_array_d, 0, num_elements);
+    memset (sorted_array_d, 0, num_elements * sizeof (int));
     gettimeofday (&start, NULL);
-    compute_using_pthreads (input_array, sorted_array_d, num_elements, range, num_threads);
+    if (!compute_using_pthreads (input_array, sorted_array_d, num_elements, min_value, max_value, num_threads)) {
+        printf ("Cannot create sorter: %s\n", strerror (errno));
+        exit (EXIT_FAILURE);
+    }
     gettimeofday (&stop, NULL);
     p_time = (stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/(float) 1000000);
     
@@ -147,235 +421,142 @@ main (int argc, char **argv)
     else
         printf ("Test failed\n");
 
-    double speedup = s_time - p_time;
+    double speedup = s_time / p_time;
     printf ("Single Threaded Execution Time: %f s\n",s_time);
     printf ("Multi Threaded Execution Time: %f s\n",p_time);
-    printf ("Speedup: %f s\n",speedup);
-
-    exit (EXIT_SUCCESS);
-}
-
-/* Reference implementation of counting sort. */
-int 
-compute_gold (int *input_array, int *sorted_array, int num_elements, int range)
-{
-    /* Compute histogram. Generate bin for each element within 
-     * the range. 
-     * */
-    int i, j;
-    int num_bins = range + 1;
-    int *bin = (int *) malloc (num_bins * sizeof (int));    
-    if (bin == NULL) {
-        perror ("Malloc");
-        return 0;
+    printf ("Speedup: %fx\n",speedup);
+
+    /* Optionally sort the same keys with a specialized key type */
+    if (key_type != NULL) {
+        printf ("\nSorting array using %s keys\n", key_type);
+        status = run_typed_sort (key_type, input_array, sorted_array_reference, num_elements, min_value, max_value);
+        if (status == 1)
+            printf ("Test passed\n");
+        else
+            printf ("Test failed\n");
     }
 
-    memset(bin, 0, num_bins); /* Initialize histogram bins to zero */ 
-    for (i = 0; i < num_elements; i++)
-        bin[input_array[i]]++;
-
-#ifdef DEBUG_MORE_VERBOSE
-    print_histogram (bin, num_bins, num_elements);
-#endif
-
-    /* Generate the sorted array. */
-    int idx = 0;
-    for (i = 0; i < num_bins; i++) {
-        for (j = 0; j < bin[i]; j++) {
-            sorted_array[idx++] = i;
-        }
+    /* Optionally run a stable sort that carries each key's input position */
+    if (payload_layout != NULL) {
+        printf ("\nSorting key-value pairs using %s payloads\n", payload_layout);
+        status = run_pair_sort (payload_layout, input_array, sorted_array_reference, num_elements, min_value, max_value, num_threads);
+        if (status == 1)
+            printf ("Test passed\n");
+        else
+            printf ("Test failed\n");
     }
 
-    return 1;
-}
-
-/* FIXME: Write multi-threaded implementation of counting sort. */
-void 
-compute_using_pthreads (int *input_array, int *sorted_array, int num_elements, int range, int num_threads)
-{
-    pthread_t *tid = (pthread_t *) malloc (sizeof (pthread_t) * num_threads); /* Data structure to store the thread IDs */
-    if (tid == NULL) {
-        perror ("malloc");
-        exit (EXIT_FAILURE);
+    /* Optionally let the adaptive front-end pick the algorithm and thread count */
+    if (adaptive) {
+        printf ("\nSorting array using the adaptive front-end\n");
+        status = run_adaptive_sort (input_array, sorted_array_reference, num_elements, min_value, max_value);
+        if (status == 1)
+            printf ("Test passed\n");
+        else
+            printf ("Test failed\n");
     }
 
-    pthread_attr_t attributes;              /* Thread attributes */
-    pthread_mutex_t mutex_for_hist;         /* Lock for the shared variable sum */
-    
-    pthread_attr_init (&attributes);            /* Initialize the thread attributes to the default values */
-    pthread_mutex_init (&mutex_for_hist, NULL);  /* Initialize the mutex */
-
-    int bar_ret = pthread_barrier_init(&barrier, NULL, num_threads); // Init thread barrier 
-    if (bar_ret != 0){
-        printf("Barrier Init Failure\n");
-        exit(EXIT_FAILURE);
-        }
-    bar_ret = pthread_barrier_init(&barrier2, NULL, num_threads); // Init thread barrier 
-    if (bar_ret != 0){
-        printf("Barrier Init Failure\n");
-        exit(EXIT_FAILURE);
-        }
-
-    int i;
-    int num_bins = range + 1;
-    int *global_bin = (int *) malloc (num_bins * sizeof (int));    
-    if (global_bin == NULL) {
-        perror ("Malloc");
-        exit(EXIT_FAILURE);
+    /* Optionally sort with cooperating processes instead of threads */
+    if (num_procs > 0) {
+        printf ("\nSorting array using %d processes\n", num_procs);
+        status = run_distributed_sort (input_array, sorted_array_reference, num_elements, min_value, max_value, num_procs);
+        if (status == 1)
+            printf ("Test passed\n");
+        else
+            printf ("Test failed\n");
     }
-    memset(global_bin, 0, num_bins); /* Initialize histogram bins to zero */
 
-    int *tbin = (int *) malloc (num_threads*num_bins * sizeof (int));    
-    if (tbin == NULL) {
-        perror ("Malloc");
-        exit(EXIT_FAILURE);
+    /* Optionally describe the sorted order as runs instead of writing it out */
+    if (run_length) {
+        printf ("\nSorting array into a run-length view\n");
+        status = run_run_length_sort (input_array, sorted_array_reference, num_elements, min_value, max_value, num_threads, RUN_SLICE);
+        if (status == 1)
+            printf ("Test passed\n");
+        else
+            printf ("Test failed\n");
     }
 
-    memset(tbin, 0, num_bins); /* Initialize histogram bins to zero */
-    int chunk = (int) floor ((float) num_bins/(float) num_threads); // Compute the chunk size
-    ARGS_FOR_THREAD **args_for_thread;      /* Fill in structure used by each thread */
-    args_for_thread = malloc (sizeof (ARGS_FOR_THREAD) * num_threads);
-    for (i = 0; i < num_threads; i++){
-        args_for_thread[i] = (ARGS_FOR_THREAD *) malloc (sizeof (ARGS_FOR_THREAD));
-        args_for_thread[i]->tid = i; 
-        args_for_thread[i]->num_threads = num_threads;
-        args_for_thread[i]->num_elements = num_elements;
-        args_for_thread[i]->mutex_for_hist = &mutex_for_hist;
-        args_for_thread[i]->input_array = input_array;
-        args_for_thread[i]->range = range;
-        args_for_thread[i]->global_bin = global_bin;
-        args_for_thread[i]->chunk_size = chunk;
-        args_for_thread[i]->sorted = sorted_array;
-        args_for_thread[i]->offset= i*chunk;
-        args_for_thread[i]->tbin = tbin;
+    /* Optionally keep the sort current under batches of updates */
+    if (batch_size > 0) {
+        printf ("\nRe-sorting after %d batches of %d updates\n", num_repetitions, batch_size);
+        status = run_incremental_sort (input_array, num_elements, min_value, max_value, num_threads, batch_size, num_repetitions, seed);
+        if (status == 1)
+            printf ("Test passed\n");
+        else
+            printf ("Test failed\n");
     }
 
+    /* Optionally profile the phases of repeated sorts on one pool */
+    if (profile_mode != NULL) {
+        printf ("\nProfiling %d sorts using pthreads\n", num_repetitions);
+        status = run_profiled_sort (profile_mode, input_array, sorted_array_reference, num_elements, min_value, max_value, num_threads, num_repetitions);
+        if (status == 1)
+            printf ("Test passed\n");
+        else
+            printf ("Test failed\n");
+    }
 
-
-    /* Create each thread and execute Jacobi function */
-    for (i = 0; i < num_threads; i++)
-        pthread_create (&tid[i], &attributes, thread_sort, (void *) args_for_thread[i]);
-					 
-    /* Wait for the workers to finish */
-    for(i = 0; i < num_threads-1; i++)
-        pthread_join (tid[i], NULL);
-        //printf("Joined\n");
-
-    #ifdef DEBUG_MORE_VERBOSE
-    printf("Global Histogram Printing:\n");
-    print_histogram (global_bin, num_bins, num_elements);
-    #endif
-
-
-
-    /* Free data structures */
-    for(i = 0; i < num_threads; i++)
-        free ((void *) args_for_thread[i]);
-
+    free (input_array);
+    free (sorted_array_reference);
+    free (sorted_array_d);
+    exit (EXIT_SUCCESS);
 }
 
-void *
-thread_sort(void *args)
-{
-    int debug = 0;
-    int idx = 0;
-    /* Unpack Args */
-    ARGS_FOR_THREAD *targs = (ARGS_FOR_THREAD *) args;
-
-    int i;
-    int num_bins = targs->range + 1;
-
-    /* Striding */ 
-    // for (i = targs->tid; i < targs->num_elements; i+=targs->num_threads){
-    //     targs->global_bin[targs->input_array[i]]++;
-    // }
-
-    //  /* Chunky Boi */
-    int chunk_el = floor(targs->num_elements/targs->num_threads);
-    int mystart = targs->tid*chunk_el;
-    int mystop = (targs->tid + 1)*chunk_el;
-
-    // for (i = mystart; i < mystop; i++){
-    //     bin[targs->input_array[i]]++;
-    // }
-    if (targs->tid < (targs->num_threads - 1)) {
-        for (i = mystart; i < mystop; i++)
-            targs->tbin[targs->tid * num_bins + targs->input_array[i]]++;
-    }
-    else { /* This takes care of the number of elements that the final thread must process */
-        for (i = mystart; i < targs->num_elements; i++)
-            targs->tbin[targs->tid * num_bins + targs->input_array[i]]++;
-    }
-    pthread_barrier_wait(&barrier);
-    if (targs->tid < (targs->num_threads - 1)) 
-    {
-        for (int i = targs->offset; i < (targs->offset + targs->chunk_size); i++)
-            for (int j = 0; j < targs->num_threads; j++)
-                targs->global_bin[i] += targs->tbin[j * num_bins + i];
-    }
-    else
-    {
-        for (int i = targs->offset; i < num_bins; i++)
-            for (int j = 0; j < targs->num_threads; j++)
-                targs->global_bin[i] += targs->tbin[j * num_bins + i];
-    }
-    
 
-    pthread_barrier_wait(&barrier2);
-
-    
 
-    if (targs->tid == 0 && debug > 0)
-    {
-        switch (debug)
-        {
-        case 1:
-            print_array(targs->input_array,targs->num_elements);
-            break;
-        case 2:
-            printf("Thread 0: Partial Histogram\n");
-            print_histogram (targs->tbin, num_bins, targs->num_elements);
-        default:
-            break;
-        }
+/* Copy the keys into an array of the named key type, sort it with the matching
+ * specialization and compare against the reference result. Returns 1 if the
+ * results match. */
+int
+run_typed_sort (const char *key_type, int *input_array, int *sorted_array_reference,
+                int num_elements, int min_value, int max_value)
+{
+    struct timeval start, stop;
+    int status = 0;
+
+#define RUN_TYPED_SORT(key_t, key_max, sort)                                        \
+    do {                                                                            \
+        if (min_value < 0 || (unsigned int) max_value > key_max) {                  \
+            printf ("Key range %d to %d does not fit %s\n", min_value, max_value, key_type); \
+            return 0;                                                               \
+        }                                                                           \
+        key_t *keys = (key_t *) malloc (num_elements * sizeof (key_t));             \
+        key_t *sorted = (key_t *) malloc (num_elements * sizeof (key_t));           \
+        if (keys == NULL || sorted == NULL) {                                       \
+            perror ("Malloc");                                                      \
+            exit (EXIT_FAILURE);                                                    \
+        }                                                                           \
+        for (int i = 0; i < num_elements; i++)                                      \
+            keys[i] = (key_t) input_array[i];                                       \
+        gettimeofday (&start, NULL);                                                \
+        status = sort (keys, sorted, num_elements, (key_t) min_value, (key_t) max_value); \
+        gettimeofday (&stop, NULL);                                                 \
+        for (int i = 0; status && i < num_elements; i++)                            \
+            if ((int) sorted[i] != sorted_array_reference[i])                       \
+                status = 0;                                                         \
+        free (keys);                                                                \
+        free (sorted);                                                              \
+    } while (0)
+
+    if (strcmp (key_type, "u8") == 0)
+        RUN_TYPED_SORT (uint8_t, UINT8_MAX, counting_sort_u8);
+    else if (strcmp (key_type, "u16") == 0)
+        RUN_TYPED_SORT (uint16_t, UINT16_MAX, counting_sort_u16);
+    else if (strcmp (key_type, "u32") == 0)
+        RUN_TYPED_SORT (uint32_t, UINT32_MAX, counting_sort_u32);
+    else {
+        printf ("Unknown key type %s\n", key_type);
+        return 0;
     }
 
-    // pthread_mutex_lock(targs->mutex_for_hist);
-    // #ifdef DEBUG_MORE_VERBOSE
-    // printf("thread %d locking...\n",targs->tid);
-    // #endif
-
-    // for (i = 0; i < num_bins; i++) {
-
-    // #ifdef DEBUG_MORE_VERBOSE
-    // printf ("Bin %d: %d\n", i, bin[i]);
-    // #endif
-
-    // targs->global_bin[i]+=bin[i];
-    // }
-
-    // pthread_mutex_unlock(targs->mutex_for_hist);
+#undef RUN_TYPED_SORT
 
-    /* Generate the sorted array. */
-
-    for (int i = 0; i < targs->offset;i++)
-        idx += targs->global_bin[i];
-    /* Generate the sorted array. */
-    if (targs->tid < (targs->num_threads - 1)) {
-        for (int i = targs->offset; i < (targs->offset + targs->chunk_size); i++)
-            for (int j = 0; j < targs->global_bin[i]; j++)
-                targs->sorted[idx++] = i;
-    }
-    else { /* This takes care of the number of elements that the final thread must process */
-        for (int i = targs->offset; i < num_bins; i++)
-            for (int j = 0; j < targs->global_bin[i]; j++)
-                targs->sorted[idx++] = i;
-    }    
-
-    
-    pthread_exit ((void *)0);
+    printf ("Typed Execution Time: %f s\n",
+            stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/(float) 1000000);
+    return status;
 }
 
+
 /* Check if the array is sorted. */
 int
 check_if_sorted (int *array, int num_elements)
@@ -407,14 +588,6 @@ compare_results (int *array_1, int *array_2, int num_elements)
 }
 
 
-/* Returns a random integer between [min, max]. */ 
-int
-rand_int (int min, int max)
-{
-    float r = rand ()/(float) RAND_MAX;
-    return (int) floorf (min + (max - min) * r);
-}
-
 /* Helper function to print the given array. */
 void
 print_array (int *this_array, int num_elements)
@@ -466,3 +639,1282 @@ print_histogram (int *bin, int num_bins, int num_elements)
 }
 
 
+/* Record used to exercise the array-of-structs payload layout */
+typedef struct test_record_t {
+    int index;                          /* Position in the input */
+    int key;
+    char data[24];
+} TEST_RECORD;
+
+/* Sort the keys together with their input positions using the named payload
+ * layout, then check that the keys match the reference, that each payload
+ * still belongs to its key and that equal keys kept their input order.
+ * Returns 1 if all checks pass. */
+int
+run_pair_sort (const char *layout, int *input_array, int *sorted_array_reference,
+               int num_elements, int min_value, int max_value, int num_threads)
+{
+    struct timeval start, stop;
+    int i, status = 1;
+    int *sorted_keys = (int *) malloc (num_elements * sizeof (int));
+    int *order = (int *) malloc (num_elements * sizeof (int));  /* Input position of each output element */
+    if (sorted_keys == NULL || order == NULL) {
+        perror ("Malloc");
+        exit (EXIT_FAILURE);
+    }
+
+    SORTER *sorter = sorter_create (num_threads, min_value, max_value);
+    if (sorter == NULL) {
+        printf ("Cannot create sorter: %s\n", strerror (errno));
+        exit (EXIT_FAILURE);
+    }
+
+    PAYLOAD payload;
+    TEST_RECORD *records = NULL, *sorted_records = NULL;
+    int *payload_src = NULL;
+    if (strcmp (layout, "soa") == 0) {
+        payload_src = (int *) malloc (num_elements * sizeof (int));
+        if (payload_src == NULL) {
+            perror ("Malloc");
+            exit (EXIT_FAILURE);
+        }
+        for (i = 0; i < num_elements; i++)
+            payload_src[i] = i;
+        payload.layout = PAYLOAD_SOA;
+        payload.size = sizeof (int);
+        payload.src = payload_src;
+        payload.dst = order;
+    }
+    else if (strcmp (layout, "aos") == 0) {
+        records = (TEST_RECORD *) malloc (num_elements * sizeof (TEST_RECORD));
+        sorted_records = (TEST_RECORD *) malloc (num_elements * sizeof (TEST_RECORD));
+        if (records == NULL || sorted_records == NULL) {
+            perror ("Malloc");
+            exit (EXIT_FAILURE);
+        }
+        for (i = 0; i < num_elements; i++) {
+            records[i].index = i;
+            records[i].key = input_array[i];
+        }
+        payload.layout = PAYLOAD_AOS;
+        payload.size = sizeof (TEST_RECORD);
+        payload.key_offset = offsetof (TEST_RECORD, key);
+        payload.src = records;
+        payload.dst = sorted_records;
+    }
+    else if (strcmp (layout, "index") == 0) {
+        payload.layout = PAYLOAD_INDEX;
+        payload.dst = order;
+    }
+    else {
+        printf ("Unknown payload layout %s\n", layout);
+        sorter_destroy (sorter);
+        return 0;
+    }
+
+    gettimeofday (&start, NULL);
+    sorter_sort_pairs (sorter, (payload.layout == PAYLOAD_AOS) ? NULL : input_array, sorted_keys, num_elements, &payload);
+    gettimeofday (&stop, NULL);
+    printf ("Key-Value Execution Time: %f s\n",
+            stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/(float) 1000000);
+
+    if (payload.layout == PAYLOAD_AOS)
+        for (i = 0; i < num_elements; i++)
+            order[i] = sorted_records[i].index;
+
+    for (i = 0; i < num_elements && status; i++) {
+        if (sorted_keys[i] != sorted_array_reference[i] || input_array[order[i]] != sorted_keys[i])
+            status = 0;
+        if (i > 0 && sorted_keys[i - 1] == sorted_keys[i] && order[i - 1] >= order[i])
+            status = 0;
+    }
+
+    sorter_destroy (sorter);
+    free (sorted_keys);
+    free (order);
+    free (payload_src);
+    free (records);
+    free (sorted_records);
+    return status;
+}
+
+/* Sort the input num_repetitions times on one pool with phase profiling 
+ * enabled, check the last result against the reference, and print the 
+ * profile. mode is "phases" for timestamps only or "counters" to add the 
+ * hardware counters. Returns 1 if the results match. */
+int
+run_profiled_sort (const char *mode, int *input_array, int *sorted_array_reference,
+                   int num_elements, int min_value, int max_value, int num_threads, int num_repetitions)
+{
+    int use_counters;
+    if (strcmp (mode, "phases") == 0)
+        use_counters = 0;
+    else if (strcmp (mode, "counters") == 0)
+        use_counters = 1;
+    else {
+        printf ("Unknown profile mode %s\n", mode);
+        return 0;
+    }
+
+    int *sorted_array = (int *) malloc (num_elements * sizeof (int));
+    if (sorted_array == NULL) {
+        perror ("Malloc");
+        exit (EXIT_FAILURE);
+    }
+    SORTER *sorter = sorter_create (num_threads, min_value, max_value);
+    if (sorter == NULL || sorter_enable_profile (sorter, use_counters) == 0) {
+        printf ("Cannot create sorter\n");
+        exit (EXIT_FAILURE);
+    }
+    if (use_counters && sorter->args_for_thread[0].profile->counter_fd[COUNTER_CYCLES] < 0)
+        printf ("Hardware counters unavailable; recording timestamps only\n");
+
+    for (int rep = 0; rep < num_repetitions; rep++)
+        sorter_sort (sorter, input_array, sorted_array, num_elements);
+    sorter_print_profile (sorter, stdout);
+
+    int status = compare_results (sorted_array_reference, sorted_array, num_elements);
+    sorter_destroy (sorter);
+    free (sorted_array);
+    return status;
+}
+
+/* Load the input into an incremental sorter, then apply num_batches batches 
+ * of batch_size random updates, with one insert in every other batch and one 
+ * delete in the rest. After each batch the refreshed output is checked against 
+ * the reference sort of the mutated keys. Compares the mean refresh time with 
+ * a full re-sort on a pool of the same size. Returns 1 if every batch matches. */
+int
+run_incremental_sort (int *input_array, int num_elements, int min_value, int max_value,
+                      int num_threads, int batch_size, int num_batches, uint64_t seed)
+{
+    struct timespec start, stop;
+    double incremental_time = 0, full_time = 0;
+    int i, b, status = 1;
+
+    int *keys = (int *) malloc ((num_elements + num_batches) * sizeof (int));
+    int *reference = (int *) malloc ((num_elements + num_batches) * sizeof (int));
+    DELTA *deltas = (DELTA *) malloc ((batch_size + 1) * sizeof (DELTA));
+    int *new_keys = (int *) malloc ((batch_size + 1) * sizeof (int));
+    int *positions = (int *) malloc ((batch_size + 1) * sizeof (int));
+    if (keys == NULL || reference == NULL || deltas == NULL || new_keys == NULL || positions == NULL) {
+        perror ("Malloc");
+        exit (EXIT_FAILURE);
+    }
+    memcpy (keys, input_array, num_elements * sizeof (int));
+
+    INCREMENTAL_SORTER *inc = incremental_create (num_threads, min_value, max_value);
+    SORTER *sorter = sorter_create (num_threads, min_value, max_value);
+    if (inc == NULL || sorter == NULL || incremental_load (inc, keys, num_elements) == 0) {
+        printf ("Cannot create sorter\n");
+        exit (EXIT_FAILURE);
+    }
+
+    for (b = 0; b < num_batches && status; b++) {
+        /* Each batch draws its new keys and the positions to update from its own seed */
+        if (generate_input (new_keys, batch_size + 1, min_value, max_value, DIST_UNIFORM, 0, seed + 2 * b, 1) == 0
+            || (num_elements > 0
+                && generate_input (positions, batch_size, 0, num_elements - 1, DIST_UNIFORM, 0, seed + 2 * b + 1, 1) == 0)) {
+            status = 0;
+            break;
+        }
+        int num_deltas = 0;
+        for (i = 0; i < batch_size && num_elements > 0; i++) {
+            int position = positions[i];
+            deltas[num_deltas].op = DELTA_UPDATE;
+            deltas[num_deltas].key = keys[position];
+            deltas[num_deltas].new_key = new_keys[i];
+            keys[position] = deltas[num_deltas++].new_key;
+        }
+        if (b % 2 == 0) {
+            deltas[num_deltas].op = DELTA_INSERT;
+            deltas[num_deltas].key = new_keys[batch_size];
+            keys[num_elements++] = deltas[num_deltas++].key;
+        }
+        else if (num_elements > 0) {
+            deltas[num_deltas].op = DELTA_DELETE;
+            deltas[num_deltas].key = keys[--num_elements];
+            num_deltas++;
+        }
+
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        const int *sorted = NULL;
+        if (incremental_apply (inc, deltas, num_deltas) == num_deltas)
+            sorted = incremental_refresh (inc);
+        clock_gettime (CLOCK_MONOTONIC, &stop);
+        incremental_time += elapsed_seconds (&start, &stop);
+
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        sorter_sort (sorter, keys, reference, num_elements);
+        clock_gettime (CLOCK_MONOTONIC, &stop);
+        full_time += elapsed_seconds (&start, &stop);
+
+        status = (sorted != NULL && inc->num_elements == num_elements
+                  && memcmp (sorted, reference, num_elements * sizeof (int)) == 0);
+    }
+
+    printf ("Incremental refresh: %f s per batch of %d updates\n", incremental_time / b, batch_size);
+    printf ("Full re-sort:        %f s per batch\n", full_time / b);
+
+    incremental_destroy (inc);
+    sorter_destroy (sorter);
+    free (keys);
+    free (reference);
+    free (deltas);
+    free (new_keys);
+    free (positions);
+    return status;
+}
+
+/* Sort the input into a run-length view and check it against the reference 
+ * three ways: run by run, key by key through a cursor, and materialized in 
+ * slices of chunk_elements. Compares the time to build the view with a full 
+ * sort on the same pool. Returns 1 if every check matches. */
+int
+run_run_length_sort (int *input_array, int *sorted_array_reference, int num_elements,
+                     int min_value, int max_value, int num_threads, int chunk_elements)
+{
+    struct timespec start, stop;
+    RUN_VIEW view;
+    RUN_CURSOR cursor;
+    int i, key, count, status = 1;
+
+    int *sorted_array = (int *) malloc (num_elements * sizeof (int));
+    int *slice = (int *) malloc (chunk_elements * sizeof (int));
+    if (sorted_array == NULL || slice == NULL) {
+        perror ("Malloc");
+        exit (EXIT_FAILURE);
+    }
+    SORTER *sorter = sorter_create (num_threads, min_value, max_value);
+    if (sorter == NULL) {
+        printf ("Cannot create sorter: %s\n", strerror (errno));
+        exit (EXIT_FAILURE);
+    }
+
+    sorter_sort (sorter, input_array, sorted_array, num_elements);      /* Warm up the pool */
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    sorter_sort (sorter, input_array, sorted_array, num_elements);
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    printf ("Full sort:       %f s\n", elapsed_seconds (&start, &stop));
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    sorter_sort_runs (sorter, input_array, num_elements, &view);
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    printf ("Run-length view: %f s\n", elapsed_seconds (&start, &stop));
+
+    i = 0;
+    run_cursor_init (&cursor, &view);
+    while (status && run_cursor_next_run (&cursor, &key, &count)) {
+        status = (i + count <= num_elements && sorted_array_reference[i] == key
+                  && sorted_array_reference[i + count - 1] == key);
+        i += count;
+    }
+    status = status && (i == num_elements);
+
+    i = 0;
+    run_cursor_init (&cursor, &view);
+    while (status && run_cursor_next (&cursor, &key))
+        status = (i < num_elements && sorted_array_reference[i++] == key);
+    status = status && (i == num_elements);
+
+    for (i = 0; status && i < num_elements; i += chunk_elements) {
+        count = (num_elements - i < chunk_elements) ? num_elements - i : chunk_elements;
+        run_view_materialize (&view, i, count, slice);
+        status = (memcmp (slice, sorted_array_reference + i, count * sizeof (int)) == 0)
+                 && run_view_key (&view, i) == sorted_array_reference[i];
+    }
+
+    sorter_destroy (sorter);
+    free (sorted_array);
+    free (slice);
+    return status;
+}
+
+/* One rank of the multi-process sort. Every rank counts its slice of the input 
+ * into its own row, then the ranks all-reduce the rows through the shared 
+ * mapping: each sums its range of bins across all rows, which leaves the 
+ * global histogram in shared memory for everyone. Each rank then scans its 
+ * bin range, offset by the totals of the ranges before it, and writes the 
+ * keys of that range into the shared output. */
+void
+distributed_worker (DIST_JOB *job, int rank, const int *input_array)
+{
+    struct timespec start, stop;
+    int i, j;
+    int num_procs = job->num_procs;
+    int num_bins = job->num_bins;
+    double *phase_time = job->phase_time + rank * NUM_DIST_PHASES;
+
+    /* Local histogram of this rank's slice */
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    int *my_bin = job->local_bin + (size_t) rank * job->stride;
+    int first = (int) ((long) rank * job->num_elements / num_procs);
+    int last = (int) ((long) (rank + 1) * job->num_elements / num_procs);
+    memset (my_bin, 0, num_bins * sizeof (int));
+    histogram_scalar (input_array + first, last - first, my_bin, num_bins, job->min_value, NULL);
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    phase_time[DIST_COUNT] = elapsed_seconds (&start, &stop);
+    pthread_barrier_wait (&job->barrier);
+
+    /* All-reduce: reduce this rank's bin range across every row */
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    int bin_start = (int) ((long) rank * num_bins / num_procs);
+    int bin_stop = (int) ((long) (rank + 1) * num_bins / num_procs);
+    int block_sum = 0;
+    for (i = bin_start; i < bin_stop; i++) {
+        int sum = 0;
+        for (j = 0; j < num_procs; j++)
+            sum += job->local_bin[(size_t) j * job->stride + i];
+        job->global_bin[i] = sum;
+        block_sum += sum;
+    }
+    job->block_sum[rank] = block_sum;
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    phase_time[DIST_REDUCE] = elapsed_seconds (&start, &stop);
+    pthread_barrier_wait (&job->barrier);
+
+    /* Exclusive prefix sum of this rank's range; no other rank needs it */
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    int idx = 0;
+    for (j = 0; j < rank; j++)
+        idx += job->block_sum[j];
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    phase_time[DIST_PREFIX] = elapsed_seconds (&start, &stop);
+
+    /* Emit the keys of this rank's range */
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    for (i = bin_start; i < bin_stop; i++) {
+        job->fill_kernel (job->sorted + idx, job->min_value + i, job->global_bin[i], 0);
+        idx += job->global_bin[i];
+    }
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    phase_time[DIST_FILL] = elapsed_seconds (&start, &stop);
+}
+
+/* Sort the input with num_procs forked processes that share one anonymous 
+ * mapping for their histogram rows, the reduced histogram and the output, 
+ * and synchronize on a process-shared barrier. Prints each process's phase 
+ * times and checks the output against the reference. Returns 1 if they match. */
+int
+run_distributed_sort (int *input_array, int *sorted_array_reference, int num_elements,
+                      int min_value, int max_value, int num_procs)
+{
+    struct timespec start, stop;
+    int p, status = 1;
+    int num_bins = max_value - min_value + 1;
+    int stride = padded_row_length (num_bins);
+
+    /* Shared layout: job, phase times, block sums, histogram rows, global histogram, output */
+    size_t times_bytes = (size_t) num_procs * NUM_DIST_PHASES * sizeof (double);
+    size_t sums_bytes = (size_t) num_procs * sizeof (int);
+    size_t rows_bytes = (size_t) num_procs * stride * sizeof (int);
+    size_t global_bytes = (size_t) stride * sizeof (int);
+    size_t shared_bytes = sizeof (DIST_JOB) + times_bytes + sums_bytes + rows_bytes + global_bytes
+                          + (size_t) num_elements * sizeof (int);
+    char *shared = (char *) mmap (NULL, shared_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror ("mmap");
+        return 0;
+    }
+
+    DIST_JOB *job = (DIST_JOB *) shared;
+    job->num_procs = num_procs;
+    job->num_elements = num_elements;
+    job->min_value = min_value;
+    job->num_bins = num_bins;
+    job->stride = stride;
+    job->fill_kernel = select_fill_kernel ();
+    job->phase_time = (double *) (shared + sizeof (DIST_JOB));
+    job->block_sum = (int *) ((char *) job->phase_time + times_bytes);
+    job->local_bin = (int *) ((char *) job->block_sum + sums_bytes);
+    job->global_bin = (int *) ((char *) job->local_bin + rows_bytes);
+    job->sorted = (int *) ((char *) job->global_bin + global_bytes);
+
+    pthread_barrierattr_t attributes;
+    pthread_barrierattr_init (&attributes);
+    pthread_barrierattr_setpshared (&attributes, PTHREAD_PROCESS_SHARED);
+    if (pthread_barrier_init (&job->barrier, &attributes, num_procs) != 0) {
+        printf ("Barrier Init Failure\n");
+        munmap (shared, shared_bytes);
+        return 0;
+    }
+    pthread_barrierattr_destroy (&attributes);
+
+    /* The children inherit the input through fork () and map the rest at the same address */
+    pid_t *pid = (pid_t *) calloc (num_procs, sizeof (pid_t));
+    if (pid == NULL) {
+        perror ("Malloc");
+        exit (EXIT_FAILURE);
+    }
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    int num_running = 0;
+    for (p = 0; p < num_procs; p++) {
+        pid[p] = fork ();
+        if (pid[p] == -1) {
+            perror ("fork");
+            status = 0;
+            break;
+        }
+        if (pid[p] == 0) {
+            distributed_worker (job, p, input_array);
+            _exit (EXIT_SUCCESS);
+        }
+        num_running++;
+    }
+
+    /* Reap the ranks in the order they finish. A rank that fails, or one that 
+     * was never forked, leaves the others waiting on the process barrier for 
+     * good, so the survivors are killed on the first failure. */
+    int killed = 0;
+    while (num_running > 0) {
+        if (!status && !killed) {
+            for (int q = 0; q < num_procs; q++)
+                if (pid[q] > 0)
+                    kill (pid[q], SIGKILL);
+            killed = 1;
+        }
+
+        int wstatus;
+        pid_t done = waitpid (-1, &wstatus, 0);
+        if (done == -1) {
+            if (errno == EINTR)
+                continue;
+            perror ("waitpid");
+            status = 0;
+            break;
+        }
+        for (p = 0; p < num_procs && pid[p] != done; p++)
+            ;
+        if (p == num_procs)
+            continue;                   /* Not a rank */
+        pid[p] = 0;                     /* Reaped; its pid may be reused */
+        num_running--;
+        if (!WIFEXITED (wstatus) || WEXITSTATUS (wstatus) != EXIT_SUCCESS)
+            status = 0;
+    }
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    printf ("Distributed Execution Time: %f s (%d processes)\n", elapsed_seconds (&start, &stop), num_procs);
+
+    printf ("process     count ms    reduce ms    prefix ms      fill ms\n");
+    for (p = 0; p < num_procs; p++) {
+        const double *phase_time = job->phase_time + p * NUM_DIST_PHASES;
+        printf ("%7d %12.3f %12.3f %12.3f %12.3f\n", p, phase_time[DIST_COUNT] * 1e3,
+                phase_time[DIST_REDUCE] * 1e3, phase_time[DIST_PREFIX] * 1e3, phase_time[DIST_FILL] * 1e3);
+    }
+
+    if (status)
+        status = compare_results (sorted_array_reference, job->sorted, num_elements);
+
+    /* A killed rank never leaves the barrier, and destroying a barrier waits 
+     * for its waiters; unmapping it is enough then, as it holds nothing else. */
+    if (!killed)
+        pthread_barrier_destroy (&job->barrier);
+    munmap (shared, shared_bytes);
+    free (pid);
+    return status;
+}
+
+/* Order keys for qsort () */
+int
+compare_u32 (const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+int
+compare_u64 (const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Radix sort num_elements random keys of key_bits (32 or 64) bits, drawn from 
+ * seed, and check the result against qsort (). With full_width clear the keys 
+ * are drawn from [min_value, max_value] instead, so the high digit passes are 
+ * skipped. Returns 1 if the results match. */
+int
+run_radix_sort (int key_bits, int num_elements, int num_threads, int full_width, int min_value, int max_value,
+                uint64_t seed)
+{
+    struct timeval start, stop;
+    int i, status;
+    size_t key_bytes = key_bits / 8;
+    if (key_bits != 32 && key_bits != 64) {
+        printf ("Radix sort supports 32- and 64-bit keys\n");
+        return 0;
+    }
+
+    void *keys = malloc (num_elements * key_bytes);
+    void *buffer = malloc (num_elements * key_bytes);
+    void *reference = malloc (num_elements * key_bytes);
+    if (keys == NULL || buffer == NULL || reference == NULL) {
+        perror ("Malloc");
+        exit (EXIT_FAILURE);
+    }
+
+    if (full_width) {
+        /* A 64-bit key is two independent full-range ints */
+        for (i = 0; i < (int) key_bytes / 4; i++)
+            if (generate_input ((int *) keys + (size_t) i * num_elements, num_elements, INT_MIN, INT_MAX,
+                                DIST_UNIFORM, 0, seed + i, num_threads) == 0)
+                exit (EXIT_FAILURE);
+    }
+    else {
+        /* Draw the keys into the reference array, then widen them in place of the keys */
+        if (generate_input ((int *) reference, num_elements, min_value, max_value, DIST_UNIFORM, 0, seed, num_threads) == 0)
+            exit (EXIT_FAILURE);
+        for (i = 0; i < num_elements; i++) {
+            uint64_t key = (uint32_t) (((int *) reference)[i] - min_value);
+            if (key_bits == 32)
+                ((uint32_t *) keys)[i] = (uint32_t) key;
+            else
+                ((uint64_t *) keys)[i] = key;
+        }
+    }
+    memcpy (reference, keys, num_elements * key_bytes);
+
+    gettimeofday (&start, NULL);
+    qsort (reference, num_elements, key_bytes, (key_bits == 32) ? compare_u32 : compare_u64);
+    gettimeofday (&stop, NULL);
+    printf ("qsort Execution Time: %f s\n",
+            stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/(float) 1000000);
+
+    SORTER *sorter = sorter_create_radix (num_threads);
+    if (sorter == NULL) {
+        printf ("Cannot create sorter: %s\n", strerror (errno));
+        exit (EXIT_FAILURE);
+    }
+    gettimeofday (&start, NULL);
+    if (key_bits == 32)
+        status = sorter_radix_sort_u32 (sorter, (uint32_t *) keys, (uint32_t *) buffer, num_elements);
+    else
+        status = sorter_radix_sort_u64 (sorter, (uint64_t *) keys, (uint64_t *) buffer, num_elements);
+    gettimeofday (&stop, NULL);
+    printf ("Radix Execution Time: %f s\n",
+            stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/(float) 1000000);
+    sorter_destroy (sorter);
+
+    if (status)
+        status = (memcmp (keys, reference, num_elements * key_bytes) == 0);
+
+    free (keys);
+    free (buffer);
+    free (reference);
+    return status;
+}
+
+/* Double-buffered chunk reader for the streaming sort. The reader thread fills
+ * one buffer while the pool counts the other; empty and full hand each
+ * buffer back and forth. A chunk of zero keys marks the end of the input. */
+typedef struct stream_reader_t {
+    FILE *fp;
+    int chunk_elements;                 /* Capacity of each buffer in keys */
+    int *buffer[2];
+    int count[2];                       /* Keys held by each full buffer */
+    sem_t empty[2];
+    sem_t full[2];
+    int min_value;
+    int max_value;
+    int error;                          /* Set on a read error or an out-of-range key */
+} STREAM_READER;
+
+/* Reader thread: read fixed-size chunks until end of input, checking that every
+ * key lies in the sorter's range before the pool indexes bins with it. */
+void *
+stream_reader (void *args)
+{
+    STREAM_READER *reader = (STREAM_READER *) args;
+    int b = 0;
+
+    while (1) {
+        sem_wait (&reader->empty[b]);
+        int count = 0;
+        if (!reader->error) {
+            size_t bytes = fread (reader->buffer[b], 1, reader->chunk_elements * sizeof (int), reader->fp);
+            if (bytes % sizeof (int) != 0 || ferror (reader->fp))
+                reader->error = 1;
+            count = bytes / sizeof (int);
+            for (int i = 0; i < count; i++)
+                if (reader->buffer[b][i] < reader->min_value || reader->buffer[b][i] > reader->max_value) {
+                    reader->error = 1;
+                    break;
+                }
+            if (reader->error)
+                count = 0;
+        }
+        reader->count[b] = count;
+        sem_post (&reader->full[b]);
+        if (count == 0)
+            break;
+        b = 1 - b;
+    }
+
+    return NULL;
+}
+
+/* Sort a stream of native-endian 32-bit keys in [min_value, max_value] from
+ * input_path ("-" for stdin) to output_path ("-" for stdout). The keys are read
+ * in chunks of chunk_elements, double-buffered against the parallel histogram
+ * of the previous chunk; the sorted keys are then written out from the
+ * accumulated counts one chunk at a time. Memory use is three chunks plus the
+ * histogram, whatever the length of the stream. Returns 1 on success. */
+int
+run_streaming_sort (const char *input_path, const char *output_path, int chunk_elements,
+                    int num_threads, int min_value, int max_value)
+{
+    struct timeval start, stop;
+    int i, b, status = 1;
+    int num_bins = max_value - min_value + 1;
+    long num_elements = 0;
+
+    STREAM_READER reader;
+    reader.fp = (strcmp (input_path, "-") == 0) ? stdin : fopen (input_path, "rb");
+    FILE *out = (strcmp (output_path, "-") == 0) ? stdout : fopen (output_path, "wb");
+    if (reader.fp == NULL || out == NULL) {
+        perror ("fopen");
+        return 0;
+    }
+    reader.chunk_elements = chunk_elements;
+    reader.min_value = min_value;
+    reader.max_value = max_value;
+    reader.error = 0;
+
+    long *total_bin = (long *) calloc (num_bins, sizeof (long));
+    int *out_buffer = (int *) malloc (chunk_elements * sizeof (int));
+    reader.buffer[0] = (int *) malloc (chunk_elements * sizeof (int));
+    reader.buffer[1] = (int *) malloc (chunk_elements * sizeof (int));
+    if (total_bin == NULL || out_buffer == NULL || reader.buffer[0] == NULL || reader.buffer[1] == NULL) {
+        perror ("Malloc");
+        exit (EXIT_FAILURE);
+    }
+    for (b = 0; b < 2; b++) {
+        sem_init (&reader.empty[b], 0, 1);
+        sem_init (&reader.full[b], 0, 0);
+    }
+
+    SORTER *sorter = sorter_create (num_threads, min_value, max_value);
+    if (sorter == NULL) {
+        printf ("Cannot create sorter: %s\n", strerror (errno));
+        exit (EXIT_FAILURE);
+    }
+
+    gettimeofday (&start, NULL);
+    pthread_t reader_tid;
+    if (pthread_create (&reader_tid, NULL, stream_reader, (void *) &reader) != 0) {
+        perror ("pthread_create");
+        exit (EXIT_FAILURE);
+    }
+
+    /* Count each chunk on the pool while the reader fetches the next one */
+    b = 0;
+    while (1) {
+        sem_wait (&reader.full[b]);
+        int count = reader.count[b];
+        if (count == 0)
+            break;
+        sorter_histogram (sorter, reader.buffer[b], count);
+        sem_post (&reader.empty[b]);
+        for (i = 0; i < num_bins; i++)
+            total_bin[i] += sorter->global_bin[i];
+        num_elements += count;
+        b = 1 - b;
+    }
+    pthread_join (reader_tid, NULL);
+    gettimeofday (&stop, NULL);
+    fprintf (stderr, "Histogram of %ld keys: %f s\n", num_elements,
+             stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/(float) 1000000);
+
+    if (reader.error) {
+        fprintf (stderr, "Error reading %s, or key outside %d to %d\n", input_path, min_value, max_value);
+        status = 0;
+    }
+
+    /* Write the sorted keys from the run lengths, one chunk at a time */
+    gettimeofday (&start, NULL);
+    FILL_KERNEL fill_kernel = select_fill_kernel ();
+    int fill = 0;
+    for (i = 0; i < num_bins && status; i++) {
+        long remaining = total_bin[i];
+        while (remaining > 0) {
+            int run = (remaining < chunk_elements - fill) ? (int) remaining : chunk_elements - fill;
+            fill_kernel (out_buffer + fill, min_value + i, run, 0);
+            fill += run;
+            remaining -= run;
+            if (fill == chunk_elements) {
+                if (fwrite (out_buffer, sizeof (int), fill, out) != (size_t) fill)
+                    status = 0;
+                fill = 0;
+            }
+        }
+    }
+    if (status && fill > 0 && fwrite (out_buffer, sizeof (int), fill, out) != (size_t) fill)
+        status = 0;
+    if (fflush (out) != 0)
+        status = 0;
+    gettimeofday (&stop, NULL);
+    fprintf (stderr, "Sorted output: %f s\n",
+             stop.tv_sec - start.tv_sec + (stop.tv_usec - start.tv_usec)/(float) 1000000);
+
+    sorter_destroy (sorter);
+    for (b = 0; b < 2; b++) {
+        sem_destroy (&reader.empty[b]);
+        sem_destroy (&reader.full[b]);
+        free (reader.buffer[b]);
+    }
+    free (total_bin);
+    free (out_buffer);
+    if (reader.fp != stdin)
+        fclose (reader.fp);
+    if (out != stdout)
+        fclose (out);
+    return status;
+}
+
+/* Map a key file and check its header. With writable set the mapping is shared
+ * so that changes reach the file. Returns the header, followed in memory by the
+ * keys, or NULL on error; *mapped_bytes receives the length of the mapping. */
+KEY_FILE_HEADER *
+map_key_file (const char *path, int writable, size_t *mapped_bytes)
+{
+    int fd = open (path, writable ? O_RDWR : O_RDONLY);
+    if (fd == -1) {
+        perror ("open");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat (fd, &st) == -1 || (size_t) st.st_size < sizeof (KEY_FILE_HEADER)) {
+        fprintf (stderr, "%s is not a key file\n", path);
+        close (fd);
+        return NULL;
+    }
+
+    /* Fault the whole file in up front rather than one page at a time during the sort */
+    KEY_FILE_HEADER *header = (KEY_FILE_HEADER *) mmap (NULL, st.st_size,
+                                                        writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                                                        (writable ? MAP_SHARED : MAP_PRIVATE) | MAP_POPULATE,
+                                                        fd, 0);
+    close (fd);
+    if (header == MAP_FAILED) {
+        perror ("mmap");
+        return NULL;
+    }
+    madvise (header, st.st_size, MADV_HUGEPAGE);
+    madvise (header, st.st_size, MADV_SEQUENTIAL);
+
+    int64_t key_min = (header->key_bytes == 4) ? INT_MIN : 0;
+    int64_t key_max = (header->key_bytes == 4) ? INT_MAX : (header->key_bytes == 2) ? UINT16_MAX : UINT8_MAX;
+    if (memcmp (header->magic, KEY_FILE_MAGIC, sizeof (header->magic)) != 0
+        || (header->key_bytes != 1 && header->key_bytes != 2 && header->key_bytes != 4)
+        || header->max_value < header->min_value
+        || header->min_value < key_min || header->max_value > key_max
+        || header->max_value - header->min_value >= INT_MAX
+        || header->num_elements > (uint64_t) INT_MAX
+        || sizeof (KEY_FILE_HEADER) + header->num_elements * header->key_bytes > (uint64_t) st.st_size) {
+        fprintf (stderr, "%s has an invalid header\n", path);
+        munmap (header, st.st_size);
+        return NULL;
+    }
+
+    *mapped_bytes = st.st_size;
+    return header;
+}
+
+/* Create a key file holding num_elements random keys of key_bytes bytes in
+ * [min_value, max_value], drawn from seed. Returns 1 on success. */
+int
+write_key_file (const char *path, int key_bytes, int num_elements, int min_value, int max_value, uint64_t seed)
+{
+    if ((key_bytes == 1 && (min_value < 0 || max_value > UINT8_MAX))
+        || (key_bytes == 2 && (min_value < 0 || max_value > UINT16_MAX))) {
+        fprintf (stderr, "Key range %d to %d does not fit %d-byte keys\n", min_value, max_value, key_bytes);
+        return 0;
+    }
+
+    size_t file_bytes = sizeof (KEY_FILE_HEADER) + (size_t) num_elements * key_bytes;
+    int fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate (fd, file_bytes) == -1) {
+        perror (path);
+        return 0;
+    }
+    KEY_FILE_HEADER *header = (KEY_FILE_HEADER *) mmap (NULL, file_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (header == MAP_FAILED) {
+        perror ("mmap");
+        return 0;
+    }
+
+    memset (header, 0, sizeof (KEY_FILE_HEADER));
+    memcpy (header->magic, KEY_FILE_MAGIC, sizeof (header->magic));
+    header->key_bytes = key_bytes;
+    header->min_value = min_value;
+    header->max_value = max_value;
+    header->num_elements = num_elements;
+
+    /* 32-bit keys are generated in place; narrower ones are generated as ints and packed */
+    void *keys = header + 1;
+    int *generated = (key_bytes == 4) ? (int *) keys : (int *) malloc ((size_t) num_elements * sizeof (int));
+    if (generated == NULL || generate_input (generated, num_elements, min_value, max_value,
+                                             DIST_UNIFORM, 0, seed, detect_num_cpus ()) == 0) {
+        if (generated == NULL)
+            perror ("Malloc");
+        else if (generated != keys)
+            free (generated);
+        munmap (header, file_bytes);
+        return 0;
+    }
+    if (key_bytes != 4) {
+        for (int i = 0; i < num_elements; i++) {
+            if (key_bytes == 1)
+                ((uint8_t *) keys)[i] = (uint8_t) generated[i];
+            else
+                ((uint16_t *) keys)[i] = (uint16_t) generated[i];
+        }
+        free (generated);
+    }
+
+    munmap (header, file_bytes);
+    return 1;
+}
+
+/* Check that every key lies in the header's range; the sort uses keys as bin indices. */
+int
+key_file_in_range (const KEY_FILE_HEADER *header)
+{
+    const void *keys = header + 1;
+    int num_elements = (int) header->num_elements;
+
+#define KEYS_IN_RANGE(key_t)                                                        \
+    for (int i = 0; i < num_elements; i++)                                          \
+        if (((const key_t *) keys)[i] < header->min_value                           \
+            || ((const key_t *) keys)[i] > header->max_value)                       \
+            return 0;
+
+    if (header->key_bytes == 1) {
+        KEYS_IN_RANGE (uint8_t)
+    }
+    else if (header->key_bytes == 2) {
+        KEYS_IN_RANGE (uint16_t)
+    }
+    else {
+        KEYS_IN_RANGE (int32_t)
+    }
+#undef KEYS_IN_RANGE
+
+    return 1;
+}
+
+/* Sort the key file at input_path. With output_path NULL the keys are sorted
+ * in place in the shared mapping; otherwise a new key file is created at
+ * output_path, mapped, and the sort writes straight into it. 1- and 2-byte
+ * keys go through the typed serial sorts, 4-byte keys through the sorter
+ * pool. Prints the time taken by each phase. Returns 1 on success. */
+int
+sort_key_file (const char *input_path, const char *output_path, int num_threads)
+{
+    struct timespec start, stop;
+    size_t input_bytes, output_bytes = 0;
+    int status = 1;
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    KEY_FILE_HEADER *input = map_key_file (input_path, output_path == NULL, &input_bytes);
+    if (input == NULL)
+        return 0;
+
+    KEY_FILE_HEADER *output = input;
+    if (output_path != NULL) {
+        output_bytes = sizeof (KEY_FILE_HEADER) + input->num_elements * input->key_bytes;
+        int fd = open (output_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1 || ftruncate (fd, output_bytes) == -1) {
+            perror (output_path);
+            munmap (input, input_bytes);
+            return 0;
+        }
+        output = (KEY_FILE_HEADER *) mmap (NULL, output_bytes, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, fd, 0);
+        close (fd);
+        if (output == MAP_FAILED) {
+            perror ("mmap");
+            munmap (input, input_bytes);
+            return 0;
+        }
+        madvise (output, output_bytes, MADV_HUGEPAGE);
+        memcpy (output, input, sizeof (KEY_FILE_HEADER));
+    }
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    printf ("Map:      %f s\n", elapsed_seconds (&start, &stop));
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    if (!key_file_in_range (input)) {
+        fprintf (stderr, "%s holds keys outside %ld to %ld\n", input_path,
+                 (long) input->min_value, (long) input->max_value);
+        status = 0;
+    }
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    printf ("Validate: %f s\n", elapsed_seconds (&start, &stop));
+
+    int num_elements = (int) input->num_elements;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    if (status) {
+        if (input->key_bytes == 1) {
+            status = counting_sort_u8 ((const uint8_t *) (input + 1), (uint8_t *) (output + 1), num_elements,
+                                       (uint8_t) input->min_value, (uint8_t) input->max_value);
+        }
+        else if (input->key_bytes == 2) {
+            status = counting_sort_u16 ((const uint16_t *) (input + 1), (uint16_t *) (output + 1), num_elements,
+                                        (uint16_t) input->min_value, (uint16_t) input->max_value);
+        }
+        else {
+            SORTER *sorter = sorter_create (num_threads, (int) input->min_value, (int) input->max_value);
+            if (sorter == NULL) {
+                status = 0;
+            }
+            else {
+                sorter_sort (sorter, (int *) (input + 1), (int *) (output + 1), num_elements);
+                sorter_destroy (sorter);
+            }
+        }
+    }
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    printf ("Sort:     %f s (%d %d-byte keys)\n", elapsed_seconds (&start, &stop), num_elements, (int) input->key_bytes);
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    if (output != input) {
+        if (msync (output, output_bytes, MS_SYNC) == -1)
+            status = 0;
+        munmap (output, output_bytes);
+    }
+    else if (msync (input, input_bytes, MS_SYNC) == -1) {
+        status = 0;
+    }
+    munmap (input, input_bytes);
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    printf ("Sync:     %f s\n", elapsed_seconds (&start, &stop));
+
+    return status;
+}
+
+
+/* Sort the input with the adaptive front-end and check it against the 
+ * reference. Returns 1 if the results match. */
+int
+run_adaptive_sort (int *input_array, int *sorted_array_reference, int num_elements, int min_value, int max_value)
+{
+    struct timespec start, stop;
+    int *sorted_array = (int *) malloc (num_elements * sizeof (int));
+    if (sorted_array == NULL) {
+        perror ("Malloc");
+        exit (EXIT_FAILURE);
+    }
+    ADAPTIVE_SORTER *adaptive = adaptive_create (min_value, max_value);
+    if (adaptive == NULL) {
+        printf ("Cannot create sorter\n");
+        exit (EXIT_FAILURE);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    int which = adaptive_sort (adaptive, input_array, sorted_array, num_elements);
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    if (which >= 0)
+        printf ("Adaptive Execution Time: %f s (%s", elapsed_seconds (&start, &stop), sort_name (which));
+    if (which == SORT_THREADED || which == SORT_RADIX)
+        printf (", %d threads", adaptive->tuning.num_cpus);
+    if (which >= 0)
+        printf (")\n");
+
+    int status = (which >= 0) && compare_results (sorted_array_reference, sorted_array, num_elements);
+    adaptive_destroy (adaptive);
+    free (sorted_array);
+    return status;
+}
+
+/* Print the command-line usage. */
+void
+print_usage (const char *program_name)
+{
+    printf ("Usage: %s [-a] [-b histogram] [-r min:max] [-d uniform|zipf[:exponent]|sorted|reverse|equal] [-s seed] [-k u8|u16|u32] [-p soa|aos|index] [-P phases|counters [-N sorts]] [-u batch-size [-N batches]] [-l] [-D num-processes] [-R 32|64] num-elements num-threads\n", program_name);
+    printf ("       %s -b calibrate\n", program_name);
+    printf ("       %s -b sharded [-r min:max] [-N repetitions] [-s seed] num-elements max-threads\n", program_name);
+    printf ("       %s -b sweep [-N repetitions] [-W warmup] [-f csv|json] [-o results-file] [-s seed] max-elements max-threads\n", program_name);
+    printf ("       %s -S input-file|- [-o output-file|-] [-r min:max] chunk-elements num-threads\n", program_name);
+    printf ("       %s -w key-file [-r min:max] [-k u8|u16] [-s seed] num-elements\n", program_name);
+    printf ("       %s -F key-file [-o sorted-key-file] num-threads\n", program_name);
+}
+
+
+/* qsort () comparison for timing samples */
+int
+compare_doubles (const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Summarize num_repetitions timing samples, sorting them in place. */
+void
+summarize_samples (double *samples, int num_repetitions, BENCH_RESULT *result)
+{
+    qsort (samples, num_repetitions, sizeof (double), compare_doubles);
+    result->min = samples[0];
+    result->median = (num_repetitions % 2) ? samples[num_repetitions / 2]
+                     : 0.5 * (samples[num_repetitions / 2 - 1] + samples[num_repetitions / 2]);
+    int p95 = (int) ceil (0.95 * num_repetitions) - 1;
+    result->p95 = samples[(p95 < 0) ? 0 : p95];
+}
+
+/* Emit one result row. Throughput counts one read of the input and one write
+ * of the output per element. */
+void
+print_bench_result (FILE *out, int json, int first, const char *algorithm, int num_elements,
+                    int num_threads, const BENCH_RESULT *result, double serial_median)
+{
+    double elements_per_s = num_elements / result->median;
+    double gb_per_s = 2.0 * num_elements * sizeof (int) / result->median / 1e9;
+    double speedup = serial_median / result->median;
+    double efficiency = speedup / num_threads;
+
+    if (json)
+        fprintf (out, "%s\n  {\"algorithm\": \"%s\", \"elements\": %d, \"threads\": %d, "
+                 "\"min_s\": %.9f, \"median_s\": %.9f, \"p95_s\": %.9f, "
+                 "\"elements_per_s\": %.1f, \"gb_per_s\": %.3f, \"speedup\": %.3f, \"efficiency\": %.3f}",
+                 first ? "" : ",", algorithm, num_elements, num_threads,
+                 result->min, result->median, result->p95, elements_per_s, gb_per_s, speedup, efficiency);
+    else
+        fprintf (out, "%s,%d,%d,%.9f,%.9f,%.9f,%.1f,%.3f,%.3f,%.3f\n",
+                 algorithm, num_elements, num_threads, result->min, result->median, result->p95,
+                 elements_per_s, gb_per_s, speedup, efficiency);
+}
+
+/* Scaling sweep. Element counts grow tenfold from 1000 up to max_elements and
+ * thread counts double from 1 up to max_threads, both always including the
+ * maximum. Every configuration gets num_warmup untimed runs and
+ * num_repetitions runs timed with CLOCK_MONOTONIC; the threaded sort reuses
+ * one sorter per thread count. Speedup and efficiency are relative to the
+ * serial median for the same input. Results go to out as CSV or JSON. */
+void
+benchmark_sweep (int max_elements, int max_threads, int num_warmup, int num_repetitions,
+                 int json, uint64_t seed, FILE *out)
+{
+    struct timespec start, stop;
+    int rep, first = 1;
+    BENCH_RESULT result;
+    int min_value = MIN_VALUE, max_value = MAX_VALUE;
+
+    int *input_array = (int *) malloc (max_elements * sizeof (int));
+    int *sorted_array = (int *) malloc (max_elements * sizeof (int));
+    double *samples = (double *) malloc (num_repetitions * sizeof (double));
+    if (input_array == NULL || sorted_array == NULL || samples == NULL) {
+        perror ("Malloc");
+        exit (EXIT_FAILURE);
+    }
+
+    if (json)
+        fprintf (out, "[");
+    else
+        fprintf (out, "algorithm,elements,threads,min_s,median_s,p95_s,elements_per_s,gb_per_s,speedup,efficiency\n");
+
+    for (long n = (max_elements < 1000) ? max_elements : 1000; ; n *= 10) {
+        int num_elements = (n < max_elements) ? (int) n : max_elements;
+        generate_input (input_array, num_elements, min_value, max_value, DIST_UNIFORM, 0, seed, max_threads);
+
+        for (rep = -num_warmup; rep < num_repetitions; rep++) {
+            clock_gettime (CLOCK_MONOTONIC, &start);
+            compute_gold (input_array, sorted_array, num_elements, min_value, max_value);
+            clock_gettime (CLOCK_MONOTONIC, &stop);
+            if (rep >= 0)
+                samples[rep] = elapsed_seconds (&start, &stop);
+        }
+        summarize_samples (samples, num_repetitions, &result);
+        double serial_median = result.median;
+        print_bench_result (out, json, first, "serial", num_elements, 1, &result, serial_median);
+        first = 0;
+
+        for (int t = 1; ; t *= 2) {
+            int num_threads = (t < max_threads) ? t : max_threads;
+            SORTER *sorter = sorter_create (num_threads, min_value, max_value);
+            if (sorter == NULL) {
+                printf ("Cannot create sorter: %s\n", strerror (errno));
+                exit (EXIT_FAILURE);
+            }
+            for (rep = -num_warmup; rep < num_repetitions; rep++) {
+                clock_gettime (CLOCK_MONOTONIC, &start);
+                sorter_sort (sorter, input_array, sorted_array, num_elements);
+                clock_gettime (CLOCK_MONOTONIC, &stop);
+                if (rep >= 0)
+                    samples[rep] = elapsed_seconds (&start, &stop);
+            }
+            sorter_destroy (sorter);
+            summarize_samples (samples, num_repetitions, &result);
+            print_bench_result (out, json, first, "threaded", num_elements, num_threads, &result, serial_median);
+            if (num_threads == max_threads)
+                break;
+        }
+
+        if (num_elements == max_elements)
+            break;
+    }
+
+    if (json)
+        fprintf (out, "\n]\n");
+
+    free (input_array);
+    free (sorted_array);
+    free (samples);
+}
+
+/* Compare the histogram kernels on uniform and skewed keys drawn from seed. 
+ * In the skewed input nine keys out of ten are the same hot key, which is the 
+ * worst case for the scalar loop. The full threaded sort is timed with each 
+ * input too. */
+void
+benchmark_histogram (int num_elements, int num_threads, uint64_t seed)
+{
+    const char *kernel_names[] = {"scalar", "sub-histograms", "avx512-conflict"};
+    HISTOGRAM_KERNEL kernels[] = {histogram_scalar, histogram_sub_histograms, histogram_avx512_conflict};
+    int num_kernels = 3;
+    int num_repetitions = 5;
+    int range = MAX_VALUE - MIN_VALUE;
+    int num_bins = range + 1;
+    struct timespec start, stop;
+    int i, k, rep;
+
+    __builtin_cpu_init ();
+    if (!(__builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512cd")))
+        num_kernels = 2;
+
+    int *input_array = (int *) malloc (num_elements * sizeof (int));
+    int *sorted_array = (int *) malloc (num_elements * sizeof (int));
+    int *bin = (int *) malloc (num_bins * sizeof (int));
+    int *reference_bin = (int *) malloc (num_bins * sizeof (int));
+    size_t scratch_bytes = (size_t) histogram_scratch_rows (histogram_sub_histograms) * padded_row_length (num_bins) * sizeof (int);
+    int *scratch = (int *) malloc (scratch_bytes);
+    if (input_array == NULL || sorted_array == NULL || bin == NULL || reference_bin == NULL || scratch == NULL) {
+        perror ("Malloc");
+        exit (EXIT_FAILURE);
+    }
+
+    SORTER *sorter = sorter_create (num_threads, MIN_VALUE, MAX_VALUE);
+    if (sorter == NULL) {
+        printf ("Cannot create sorter: %s\n", strerror (errno));
+        exit (EXIT_FAILURE);
+    }
+
+    for (int skewed = 0; skewed <= 1; skewed++) {
+        /* The skewed input replaces the uniform keys where a draw from [0, 9], 
+         * made into sorted_array before it is needed, is not zero */
+        if (generate_input (input_array, num_elements, MIN_VALUE, MAX_VALUE, DIST_UNIFORM, 0, seed, num_threads) == 0
+            || (skewed && generate_input (sorted_array, num_elements, 0, 9, DIST_UNIFORM, 0, seed + 1, num_threads) == 0))
+            exit (EXIT_FAILURE);
+        int hot_key = (num_elements > 0) ? input_array[0] : MIN_VALUE;
+        for (i = 0; skewed && i < num_elements; i++)
+            if (sorted_array[i] != 0)
+                input_array[i] = hot_key;
+
+        printf ("\n%s keys, %d elements\n", skewed ? "Skewed" : "Uniform", num_elements);
+        memset (reference_bin, 0, num_bins * sizeof (int));
+        histogram_scalar (input_array, num_elements, reference_bin, num_bins, MIN_VALUE, scratch);
+
+        for (k = 0; k < num_kernels; k++) {
+            double best = 0;
+            for (rep = 0; rep < num_repetitions; rep++) {
+                memset (bin, 0, num_bins * sizeof (int));
+                memset (scratch, 0, scratch_bytes);
+                clock_gettime (CLOCK_MONOTONIC, &start);
+                kernels[k] (input_array, num_elements, bin, num_bins, MIN_VALUE, scratch);
+                histogram_fold (bin, num_bins, scratch, histogram_scratch_rows (kernels[k]));
+                clock_gettime (CLOCK_MONOTONIC, &stop);
+                double t = elapsed_seconds (&start, &stop);
+                if (rep == 0 || t < best)
+                    best = t;
+            }
+            int status = (memcmp (bin, reference_bin, num_bins * sizeof (int)) == 0);
+            printf ("  %-16s %10.6f s  %8.1f Melements/s  %s\n", kernel_names[k], best,
+                    num_elements / best / 1e6, status ? "ok" : "MISMATCH");
+        }
+
+        double best = 0;
+        for (rep = 0; rep < num_repetitions; rep++) {
+            clock_gettime (CLOCK_MONOTONIC, &start);
+            sorter_sort (sorter, input_array, sorted_array, num_elements);
+            clock_gettime (CLOCK_MONOTONIC, &stop);
+            double t = elapsed_seconds (&start, &stop);
+            if (rep == 0 || t < best)
+                best = t;
+        }
+        printf ("  %-16s %10.6f s  %8.1f Melements/s  (%d threads)\n", "threaded sort", best,
+                num_elements / best / 1e6, num_threads);
+    }
+
+    sorter_destroy (sorter);
+    free (input_array);
+    free (sorted_array);
+    free (bin);
+    free (reference_bin);
+    free (scratch);
+}
+
+/* Compare private histogram rows against sharded atomic counters as the thread 
+ * count doubles up to max_threads, timing the count and reduce phases through 
+ * sorter_histogram () on uniform keys in [min_value, max_value] drawn from 
+ * seed. Private rows cost memory and reduction work in proportion to threads 
+ * times bins, shards in proportion to shards times bins, but pay for contended 
+ * atomic adds. */
+void
+benchmark_sharded (int num_elements, int max_threads, int min_value, int max_value, int num_repetitions,
+                   uint64_t seed)
+{
+    struct timespec start, stop;
+    int num_bins = max_value - min_value + 1;
+    size_t row_bytes = padded_row_length (num_bins) * sizeof (int);
+
+    int *input_array = (int *) malloc (num_elements * sizeof (int));
+    int *reference_bin = (int *) malloc (num_bins * sizeof (int));
+    if (input_array == NULL || reference_bin == NULL) {
+        perror ("Malloc");
+        exit (EXIT_FAILURE);
+    }
+    if (generate_input (input_array, num_elements, min_value, max_value, DIST_UNIFORM, 0, seed, max_threads) == 0)
+        exit (EXIT_FAILURE);
+
+    printf ("%d elements, %d bins, %d threads per shard, seed %llu\n", num_elements, num_bins, THREADS_PER_SHARD,
+            (unsigned long long) seed);
+    printf ("threads    private s    sharded s   private KB   sharded KB  faster\n");
+    for (int t = 1; ; t *= 2) {
+        int num_threads = (t < max_threads) ? t : max_threads;
+        double best[2] = {0, 0};
+        int status = 1;
+
+        for (int sharded = 0; sharded <= 1; sharded++) {
+            SORTER *sorter = sorter_create_sharded (num_threads, min_value, max_value, sharded ? THREADS_PER_SHARD : 0);
+            if (sorter == NULL) {
+                printf ("Cannot create sorter: %s\n", strerror (errno));
+                exit (EXIT_FAILURE);
+            }
+            for (int rep = 0; rep < num_repetitions; rep++) {
+                clock_gettime (CLOCK_MONOTONIC, &start);
+                sorter_histogram (sorter, input_array, num_elements);
+                clock_gettime (CLOCK_MONOTONIC, &stop);
+                double time = elapsed_seconds (&start, &stop);
+                if (rep == 0 || time < best[sharded])
+                    best[sharded] = time;
+            }
+            if (!sharded)
+                memcpy (reference_bin, sorter->global_bin, num_bins * sizeof (int));
+            else
+                status = (memcmp (reference_bin, sorter->global_bin, num_bins * sizeof (int)) == 0);
+            sorter_destroy (sorter);
+        }
+
+        int num_shards = (num_threads + THREADS_PER_SHARD - 1) / THREADS_PER_SHARD;
+        printf ("%7d %12.6f %12.6f %12zu %12zu  %s%s\n", num_threads, best[0], best[1],
+                num_threads * (1 + histogram_scratch_rows (select_histogram_kernel (num_bins))) * row_bytes / 1024,
+                num_shards * row_bytes / 1024,
+                (best[1] < best[0]) ? "sharded" : "private", status ? "" : "  MISMATCH");
+        if (num_threads == max_threads)
+            break;
+    }
+
+    free (input_array);
+    free (reference_bin);
+}
@@ -0,0 +1,2236 @@
+/* Counting sort library; see sorter.h for the interface and build commands.
+ *
+ * Author: Naga Kandasamy
+ * Date created: February 24, 2020
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <immintrin.h>
+
+#include "sorter.h"
+
+/* Counting tiles claimed from the shared cursor are at least COUNT_TILE keys, 
+ * and at least TILE_ELEMENTS_PER_BIN keys per bin so that the per-call setup of 
+ * the histogram kernel stays small. Inputs too small for TILES_PER_WORKER 
+ * tiles per worker get smaller tiles instead, down to one cache line of keys. */
+#define COUNT_TILE (1 << 14)
+#define TILE_ELEMENTS_PER_BIN 8
+#define TILES_PER_WORKER 4
+
+/* Shortest run, in ints, worth writing with non-temporal stores */
+#define FILL_STREAMING_MIN_RUN 64
+
+/* Comment out to leave worker placement to the scheduler. Pinning keeps a 
+ * worker on the node where its histogram row was first touched. */
+#define PIN_WORKERS
+
+#ifdef PIN_WORKERS
+/* Index, among the CPUs allowed, of the CPU for the first worker of the next 
+ * pool. Each pool takes the next num_threads CPUs in turn, so that pools that 
+ * live side by side spread out instead of stacking on the first CPUs. */
+static unsigned int next_worker_cpu;
+#endif
+
+/* barrier, barrier2, barrier3, start_barrier and done_barrier */
+#define NUM_BARRIERS 5
+
+/* Keys per independently seeded generator block, and per batch of raw 
+ * random numbers mapped onto the key range at once */
+#define GENERATOR_BLOCK (1 << 16)
+#define GENERATOR_BATCH 256
+
+/* Tuning cache in $HOME, unless $COUNTING_SORT_TUNING names another file */
+#define TUNING_FILE ".counting_sort_tuning"
+
+/* Largest input, best-of count and narrow key range, [0, CALIBRATION_BINS), 
+ * of the calibration runs */
+#define CALIBRATION_ELEMENTS (1 << 20)
+#define CALIBRATION_REPETITIONS 3
+#define CALIBRATION_BINS 1024
+
+/* Typed sorts with at most this many bins keep their histogram on the stack */
+#define STACK_HISTOGRAM_BINS 4096
+
+/* Serial counting sort specialized for a key type and a bin counter type.
+ * DEFINE_COUNTING_SORT (name, key_t, count_t) expands to
+ *
+ *     int name (const key_t *input_array, key_t *sorted_array, size_t num_elements,
+ *               key_t min_value, key_t max_value)
+ *
+ * which returns 1 on success and 0 if the range is empty or the bins cannot be
+ * allocated. count_t must be able to hold num_elements. Ranges of up to
+ * STACK_HISTOGRAM_BINS keys keep their histogram on the stack, so small key
+ * types with narrow counters stay L1-resident. */
+#define DEFINE_COUNTING_SORT(name, key_t, count_t)                                  \
+int                                                                                 \
+name (const key_t *input_array, key_t *sorted_array, size_t num_elements,          \
+      key_t min_value, key_t max_value)                                             \
+{                                                                                   \
+    if (max_value < min_value)                                                      \
+        return 0;                                                                   \
+                                                                                    \
+    size_t i, idx;                                                                  \
+    size_t num_bins = (size_t) max_value - (size_t) min_value + 1;                  \
+    count_t stack_bin[STACK_HISTOGRAM_BINS];                                        \
+    count_t *bin = stack_bin;                                                       \
+    if (num_bins > STACK_HISTOGRAM_BINS) {                                          \
+        bin = (count_t *) calloc (num_bins, sizeof (count_t));                      \
+        if (bin == NULL) {                                                          \
+            perror ("Malloc");                                                      \
+            return 0;                                                               \
+        }                                                                           \
+    }                                                                               \
+    else {                                                                          \
+        memset (stack_bin, 0, num_bins * sizeof (count_t));                         \
+    }                                                                               \
+    for (i = 0; i < num_elements; i++)                                              \
+        bin[input_array[i] - min_value]++;                                          \
+                                                                                    \
+    idx = 0;                                                                        \
+    for (i = 0; i < num_bins; i++) {                                                \
+        key_t key = (key_t) (min_value + i);                                        \
+        for (count_t j = 0; j < bin[i]; j++)                                        \
+            sorted_array[idx++] = key;                                              \
+    }                                                                               \
+                                                                                    \
+    if (bin != stack_bin)                                                           \
+        free (bin);                                                                 \
+    return 1;                                                                       \
+}
+
+/* DEFINE_COUNTING_SORT_DISPATCH (name, key_t) defines name (), which uses the
+ * 16-bit counter instantiation name_c16 () when every count fits and the
+ * 32-bit one, name_c32 (), otherwise. */
+#define DEFINE_COUNTING_SORT_DISPATCH(name, key_t)                                  \
+DEFINE_COUNTING_SORT (name ## _c16, key_t, uint16_t)                                \
+DEFINE_COUNTING_SORT (name ## _c32, key_t, uint32_t)                                \
+int                                                                                 \
+name (const key_t *input_array, key_t *sorted_array, size_t num_elements,          \
+      key_t min_value, key_t max_value)                                             \
+{                                                                                   \
+    if (num_elements <= UINT16_MAX)                                                 \
+        return name ## _c16 (input_array, sorted_array, num_elements, min_value, max_value); \
+    if (num_elements <= UINT32_MAX)                                                 \
+        return name ## _c32 (input_array, sorted_array, num_elements, min_value, max_value); \
+    return 0;                                                                       \
+}
+
+/* State shared by the input generator threads */
+typedef struct generator_t {
+    int *input_array;
+    long num_elements;
+    int min_value;
+    int max_value;
+    int distribution;                   /* One of the DIST_ values */
+    double *zipf_cdf;                   /* DIST_ZIPF: cumulative probability of each key */
+    uint64_t seed;
+    int num_threads;
+} GENERATOR;
+
+typedef struct generator_args_t {
+    int tid;                            /* The thread ID */
+    const GENERATOR *gen;
+} GENERATOR_ARGS;
+
+static const char *sort_names[NUM_SORTS] = { "comparison", "serial", "threaded", "radix" };
+
+/* Names of the TUNING constants in the cache file */
+static const struct {
+    const char *name;
+    size_t offset;
+} tuning_fields[] = {
+    { "compare_ns", offsetof (TUNING, compare_ns) },
+    { "serial_element_ns", offsetof (TUNING, serial_element_ns) },
+    { "serial_bin_ns", offsetof (TUNING, serial_bin_ns) },
+    { "dispatch_ns", offsetof (TUNING, dispatch_ns) },
+    { "threaded_element_ns", offsetof (TUNING, threaded_element_ns) },
+    { "radix_element_ns", offsetof (TUNING, radix_element_ns) },
+};
+#define NUM_TUNING_FIELDS ((int) (sizeof (tuning_fields) / sizeof (tuning_fields[0])))
+
+void scatter_pairs (ARGS_FOR_THREAD *, int, int);
+void thread_radix_sort (ARGS_FOR_THREAD *);
+void *sorter_worker (void *);
+void set_count_tiles (SORTER *, int);
+void fill_run_scalar (int *, int, int, int);
+void fill_run_avx2 (int *, int, int, int);
+void fill_run_avx512 (int *, int, int, int);
+void *thread_sort(void*);
+int find_bin (const int *, int, int);
+void *generator_thread (void *);
+int compare_ints (const void *, const void *);
+double time_sort (int, SORTER *, int *, int *, uint32_t *, int, int);
+
+/* Reference implementation of counting sort for keys in [min_value, max_value]. */
+int 
+compute_gold (int *input_array, int *sorted_array, int num_elements, int min_value, int max_value)
+{
+    /* Compute histogram. Generate bin for each element within 
+     * the range. 
+     * */
+    int i;
+    int num_bins = max_value - min_value + 1;
+    HISTOGRAM_KERNEL histogram_kernel = select_histogram_kernel (num_bins);
+    int stride = padded_row_length (num_bins);
+    int scratch_rows = histogram_scratch_rows (histogram_kernel);
+
+    /* The histogram and any scratch rows its kernel needs share one allocation */
+    int *bin = (int *) malloc ((size_t) (1 + scratch_rows) * stride * sizeof (int));
+    if (bin == NULL) {
+        perror ("Malloc");
+        return 0;
+    }
+    int *scratch = (scratch_rows > 0) ? bin + stride : NULL;
+
+    memset(bin, 0, (size_t) (1 + scratch_rows) * stride * sizeof (int)); /* Initialize histogram bins to zero */ 
+    histogram_kernel (input_array, num_elements, bin, num_bins, min_value, scratch);
+    histogram_fold (bin, num_bins, scratch, scratch_rows);
+
+    /* Generate the sorted array. */
+    FILL_KERNEL fill_kernel = select_fill_kernel ();
+    int streaming = ((long) num_elements * sizeof (int) > last_level_cache_size ());
+    int idx = 0;
+    for (i = 0; i < num_bins; i++) {
+        fill_kernel (sorted_array + idx, min_value + i, bin[i], streaming);
+        idx += bin[i];
+    }
+    if (streaming)
+        _mm_sfence ();
+
+    free (bin);
+    return 1;
+}
+
+/* Multi-threaded implementation of counting sort. One-shot wrapper around
+ * the sorter pool; callers that sort repeatedly should keep a SORTER around
+ * and call sorter_sort () directly. Returns 1 on success. */
+int
+compute_using_pthreads (int *input_array, int *sorted_array, int num_elements, int min_value, int max_value, int num_threads)
+{
+    SORTER *sorter = sorter_create (num_threads, min_value, max_value);
+    if (sorter == NULL)
+        return 0;
+
+    sorter_sort (sorter, input_array, sorted_array, num_elements);
+    sorter_destroy (sorter);
+    return 1;
+}
+
+/* Create a sorter with a pool of num_threads parked workers for keys in 
+ * [min_value, max_value]. Returns NULL on failure. */
+SORTER *
+sorter_create (int num_threads, int min_value, int max_value)
+{
+    return sorter_create_sharded (num_threads, min_value, max_value, 0);
+}
+
+/* Create a sorter whose workers count into shared histogram shards with 
+ * relaxed atomic adds, one shard per group of threads_per_shard workers, 
+ * instead of into private rows. The histogram memory and the reduction then 
+ * scale with the number of shards rather than the number of workers. With 
+ * threads_per_shard 0 this is sorter_create (). A sharded sorter supports 
+ * sorter_sort () and sorter_histogram () only. Returns NULL on failure, with 
+ * errno set as by sorter_init (). */
+SORTER *
+sorter_create_sharded (int num_threads, int min_value, int max_value, int threads_per_shard)
+{
+    size_t arena_bytes = sorter_arena_bytes (num_threads, min_value, max_value, threads_per_shard);
+    void *arena = NULL;
+    int error = posix_memalign (&arena, sysconf (_SC_PAGESIZE), arena_bytes);
+    if (error != 0) {
+        errno = error;
+        return NULL;
+    }
+
+    SORTER *sorter = sorter_init (arena, arena_bytes, num_threads, min_value, max_value, threads_per_shard);
+    if (sorter == NULL) {
+        error = errno;
+        free (arena);
+        errno = error;
+        return NULL;
+    }
+    sorter->owned_arena = arena;
+    return sorter;
+}
+
+/* Take bytes at the given power-of-two alignment from an arena starting at 
+ * base, of which *used bytes are already taken. With base NULL the space is 
+ * only counted. */
+static void *
+arena_take (char *base, size_t *used, size_t bytes, size_t align)
+{
+    uintptr_t start = ((uintptr_t) base + *used + align - 1) & ~(uintptr_t) (align - 1);
+    *used = start - (uintptr_t) base + bytes;
+    return (base != NULL) ? (void *) start : NULL;
+}
+
+/* Lay out a sorter in the arena at base: the SORTER itself, its per-worker 
+ * arrays, the global histogram and prefix sums, and then the histogram rows, 
+ * each starting on its own page. A private row is followed by scratch_rows 
+ * sub-histogram rows for its worker's kernel. With base NULL the layout is 
+ * only measured. Returns the sorter, or NULL when measuring; *used receives 
+ * the bytes taken. */
+static SORTER *
+sorter_layout (char *base, size_t *used, int num_threads, int num_bins, int threads_per_shard, int scratch_rows)
+{
+    int i;
+    SORTER measured;
+    size_t page = sysconf (_SC_PAGESIZE);
+    int stride = padded_row_length (num_bins);
+    int num_shards = (threads_per_shard > 0) ? (num_threads + threads_per_shard - 1) / threads_per_shard : 0;
+
+    *used = 0;
+    SORTER *sorter = (SORTER *) arena_take (base, used, sizeof (SORTER), CACHE_LINE_SIZE);
+    SORTER *layout = (sorter != NULL) ? sorter : &measured;
+    layout->tid = (pthread_t *) arena_take (base, used, num_threads * sizeof (pthread_t), CACHE_LINE_SIZE);
+    layout->args_for_thread = (ARGS_FOR_THREAD *) arena_take (base, used, num_threads * sizeof (ARGS_FOR_THREAD),
+                                                              CACHE_LINE_SIZE);
+    layout->tbin = (int **) arena_take (base, used, num_threads * sizeof (int *), CACHE_LINE_SIZE);
+    layout->shard = (int **) arena_take (base, used, ((num_shards > 0) ? num_shards : 1) * sizeof (int *),
+                                         CACHE_LINE_SIZE);
+    layout->block_sum = (int *) arena_take (base, used, num_threads * sizeof (int), CACHE_LINE_SIZE);
+    layout->global_bin = (int *) arena_take (base, used, num_bins * sizeof (int), CACHE_LINE_SIZE);
+    layout->bin_offset = (int *) arena_take (base, used, (num_bins + 1) * sizeof (int), CACHE_LINE_SIZE);
+
+    if (threads_per_shard == 0) {
+        for (i = 0; i < num_threads; i++) {
+            int *row = (int *) arena_take (base, used, (size_t) (1 + scratch_rows) * stride * sizeof (int), page);
+            if (base != NULL)
+                layout->tbin[i] = row;
+        }
+    }
+    else {
+        for (i = 0; i < num_shards; i++) {
+            int *row = (int *) arena_take (base, used, stride * sizeof (int), page);
+            if (base != NULL)
+                layout->shard[i] = row;
+        }
+    }
+
+    return sorter;
+}
+
+/* Size of the arena that sorter_init () needs for these parameters, at any 
+ * alignment of the arena. The layout is measured from a page-aligned start. 
+ * From a start o bytes past a page boundary, the sorter begins at the next 
+ * cache line, which is at most the next page boundary, so the first row starts 
+ * at most one page later in memory, that is at most a page less o bytes later 
+ * in the arena; the rows after it lie the same from there. sorter_init () 
+ * checks the layout it gets against the arena all the same. */
+size_t
+sorter_arena_bytes (int num_threads, int min_value, int max_value, int threads_per_shard)
+{
+    size_t used;
+    int num_bins = max_value - min_value + 1;
+    sorter_layout (NULL, &used, num_threads, num_bins, (threads_per_shard > 0) ? threads_per_shard : 0,
+                   histogram_scratch_rows (select_histogram_kernel (num_bins)));
+    return used + sysconf (_SC_PAGESIZE) - 1;
+}
+
+/* Destroy the first num_barriers of the sorter's barriers, in the order 
+ * sorter_init () creates them. */
+static void
+destroy_barriers (SORTER *sorter, int num_barriers)
+{
+    pthread_barrier_t *barrier[NUM_BARRIERS] = { &sorter->barrier, &sorter->barrier2, &sorter->barrier3,
+                                                &sorter->start_barrier, &sorter->done_barrier };
+    for (int i = 0; i < num_barriers; i++)
+        pthread_barrier_destroy (barrier[i]);
+}
+
+/* Create a sorter as sorter_create_sharded () does, but inside the caller's 
+ * arena of arena_bytes bytes, which must be at least sorter_arena_bytes (). 
+ * Nothing else is allocated up front, and sorting allocates nothing per call. 
+ * The arena must stay in place until sorter_destroy (), after which it is the 
+ * caller's again. The workers first-touch their rows, so an arena whose pages 
+ * have not been touched yet keeps each row on its worker's node. Prints 
+ * nothing; returns NULL on failure with errno set: EINVAL for no threads, an 
+ * empty range or a short arena, else the error of the barrier or thread that 
+ * could not be created. */
+SORTER *
+sorter_init (void *arena, size_t arena_bytes, int num_threads, int min_value, int max_value, int threads_per_shard)
+{
+    int i;
+    int range = max_value - min_value;
+    size_t used;
+    threads_per_shard = (threads_per_shard > 0) ? threads_per_shard : 0;
+    if (num_threads < 1 || range < 0
+        || arena == NULL || arena_bytes < sorter_arena_bytes (num_threads, min_value, max_value, threads_per_shard)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    HISTOGRAM_KERNEL histogram_kernel = select_histogram_kernel (range + 1);
+    int scratch_rows = histogram_scratch_rows (histogram_kernel);
+    SORTER *sorter = sorter_layout ((char *) arena, &used, num_threads, range + 1, threads_per_shard, scratch_rows);
+    if (used > arena_bytes) {
+        /* Only the pointers in the sorter were written, all inside the arena */
+        errno = EINVAL;
+        return NULL;
+    }
+
+    sorter->num_threads = num_threads;
+    sorter->min_value = min_value;
+    sorter->range = range;
+    sorter->num_bins = range + 1;
+    sorter->shutdown = 0;
+    sorter->owned_arena = NULL;
+    sorter->tbin_stride = padded_row_length (sorter->num_bins);
+    sorter->threads_per_shard = threads_per_shard;
+    sorter->num_shards = (threads_per_shard > 0) ? (num_threads + threads_per_shard - 1) / threads_per_shard : 0;
+    sorter->histogram_kernel = histogram_kernel;
+    sorter->scratch_rows = scratch_rows;
+    sorter->fill_kernel = select_fill_kernel ();
+    sorter->llc_bytes = last_level_cache_size ();
+
+    pthread_barrier_t *barrier[NUM_BARRIERS] = { &sorter->barrier, &sorter->barrier2, &sorter->barrier3,
+                                                &sorter->start_barrier, &sorter->done_barrier };
+    for (i = 0; i < NUM_BARRIERS; i++) {
+        /* The last two also count the submitter */
+        int error = pthread_barrier_init (barrier[i], NULL, (i < 3) ? num_threads : num_threads + 1);
+        if (error != 0) {
+            destroy_barriers (sorter, i);
+            errno = error;
+            return NULL;
+        }
+    }
+    pthread_mutex_init (&sorter->launch, NULL);
+
+    /* Fill in the parts of the structure used by each thread that do not change between sorts */
+    int chunk = (int) floor ((float) sorter->num_bins/(float) num_threads); // Compute the chunk size
+    for (i = 0; i < num_threads; i++) {
+        ARGS_FOR_THREAD *targs = &sorter->args_for_thread[i];
+        targs->tid = i;
+        targs->num_threads = num_threads;
+        targs->range = range;
+        targs->min_value = min_value;
+        targs->global_bin = sorter->global_bin;
+        targs->chunk_size = chunk;
+        targs->offset = i * chunk;
+        targs->tbin = sorter->tbin;
+        targs->scratch = (threads_per_shard == 0 && scratch_rows > 0) ? sorter->tbin[i] + sorter->tbin_stride : NULL;
+        targs->idx = NULL;
+        targs->barrier = &sorter->barrier;
+        targs->barrier2 = &sorter->barrier2;
+        targs->barrier3 = &sorter->barrier3;
+        targs->bin_offset = sorter->bin_offset;
+        targs->block_sum = sorter->block_sum;
+        targs->payload = NULL;
+        targs->radix = NULL;
+        targs->histogram_only = 0;
+        targs->prefix_only = 0;
+        targs->wc_buffer = NULL;
+        targs->wc_fill = NULL;
+        targs->profile = NULL;
+        targs->sorter = sorter;
+    }
+
+    /* Create the workers. Each one waits for the launch lock, first-touches its 
+     * own histogram row, reports in on done_barrier, then parks on start_barrier 
+     * until a job is submitted. Holding the lock until every worker exists lets 
+     * a failed launch retire the ones already created before they reach a barrier. */
+    pthread_attr_t attributes;                  /* Thread attributes */
+#ifdef PIN_WORKERS
+    cpu_set_t allowed;
+    int num_cpus = 0;
+    sched_getaffinity (0, sizeof (allowed), &allowed);
+    int cpus[CPU_SETSIZE];
+    for (i = 0; i < CPU_SETSIZE; i++)
+        if (CPU_ISSET (i, &allowed))
+            cpus[num_cpus++] = i;
+    unsigned int first_cpu = __atomic_fetch_add (&next_worker_cpu, (unsigned int) num_threads, __ATOMIC_RELAXED);
+#endif
+    pthread_mutex_lock (&sorter->launch);
+    for (i = 0; i < num_threads; i++) {
+        pthread_attr_init (&attributes);        /* Initialize the thread attributes to the default values */
+#ifdef PIN_WORKERS
+        if (num_cpus > 0) {
+            cpu_set_t cpu;
+            CPU_ZERO (&cpu);
+            CPU_SET (cpus[(first_cpu + i) % num_cpus], &cpu);
+            pthread_attr_setaffinity_np (&attributes, sizeof (cpu), &cpu);
+        }
+#endif
+        int error = pthread_create (&sorter->tid[i], &attributes, sorter_worker, (void *) &sorter->args_for_thread[i]);
+        pthread_attr_destroy (&attributes);
+        if (error != 0) {
+            sorter->shutdown = 1;
+            pthread_mutex_unlock (&sorter->launch);
+            while (i-- > 0)
+                pthread_join (sorter->tid[i], NULL);
+            destroy_barriers (sorter, NUM_BARRIERS);
+            pthread_mutex_destroy (&sorter->launch);
+            errno = error;
+            return NULL;
+        }
+    }
+    pthread_mutex_unlock (&sorter->launch);
+
+    pthread_barrier_wait (&sorter->done_barrier);   /* Wait for every row to be touched */
+
+    return sorter;
+}
+
+/* Sort num_elements keys from input_array into sorted_array using the parked workers.
+ * Blocks until the sorted array is complete. */
+void
+sorter_sort (SORTER *sorter, int *input_array, int *sorted_array, int num_elements)
+{
+    int i;
+    for (i = 0; i < sorter->num_threads; i++) {
+        sorter->args_for_thread[i].num_elements = num_elements;
+        sorter->args_for_thread[i].input_array = input_array;
+        sorter->args_for_thread[i].sorted = sorted_array;
+        sorter->args_for_thread[i].payload = NULL;
+    }
+    set_count_tiles (sorter, num_elements);
+
+    pthread_barrier_wait (&sorter->start_barrier);   /* Release the workers */
+    pthread_barrier_wait (&sorter->done_barrier);    /* Wait for the workers to finish */
+}
+
+/* Count num_elements keys on the pool without sorting them. The histogram is 
+ * left in sorter->global_bin. Blocks until the counts are complete. */
+void
+sorter_histogram (SORTER *sorter, const int *input_array, int num_elements)
+{
+    int i;
+    for (i = 0; i < sorter->num_threads; i++) {
+        sorter->args_for_thread[i].num_elements = num_elements;
+        sorter->args_for_thread[i].input_array = (int *) input_array;
+        sorter->args_for_thread[i].sorted = NULL;
+        sorter->args_for_thread[i].payload = NULL;
+        sorter->args_for_thread[i].histogram_only = 1;
+    }
+    set_count_tiles (sorter, num_elements);
+
+    pthread_barrier_wait (&sorter->start_barrier);   /* Release the workers */
+    pthread_barrier_wait (&sorter->done_barrier);    /* Wait for the workers to finish */
+
+    for (i = 0; i < sorter->num_threads; i++)
+        sorter->args_for_thread[i].histogram_only = 0;
+}
+
+/* Stable sort of num_elements keys together with the payload described by payload. 
+ * For PAYLOAD_AOS the keys are read from the records and input_array may be NULL; 
+ * sorted_array may be NULL if only the payload is wanted. Equal keys keep their 
+ * input order. Blocks until the sort is complete. Returns 0 without sorting 
+ * on a sharded sorter, which has no per-thread counts to order equal keys by, 
+ * and 1 otherwise. */
+int
+sorter_sort_pairs (SORTER *sorter, const int *input_array, int *sorted_array, int num_elements, PAYLOAD *payload)
+{
+    int i;
+    if (sorter->threads_per_shard > 0)
+        return 0;
+
+    for (i = 0; i < sorter->num_threads; i++) {
+        sorter->args_for_thread[i].num_elements = num_elements;
+        sorter->args_for_thread[i].input_array = (int *) input_array;
+        sorter->args_for_thread[i].sorted = sorted_array;
+        sorter->args_for_thread[i].payload = payload;
+    }
+
+    pthread_barrier_wait (&sorter->start_barrier);   /* Release the workers */
+    pthread_barrier_wait (&sorter->done_barrier);    /* Wait for the workers to finish */
+    return 1;
+}
+
+/* Record per-phase timestamps in every worker for the sorts that follow, and 
+ * with use_counters set also cycles and LLC misses through perf_event_open (). 
+ * A counter that cannot be opened, for example because of perf_event_paranoid, 
+ * is left out of the report. Returns 1 on success. */
+int
+sorter_enable_profile (SORTER *sorter, int use_counters)
+{
+    static const uint64_t counter_config[NUM_COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES };
+    int i, c;
+
+    for (i = 0; i < sorter->num_threads; i++) {
+        ARGS_FOR_THREAD *targs = &sorter->args_for_thread[i];
+        if (targs->profile != NULL)
+            continue;
+
+        /* Aligned so that neighbouring workers' rings never share a line */
+        void *ring = NULL;
+        if (posix_memalign (&ring, CACHE_LINE_SIZE, sizeof (PHASE_PROFILE)) != 0) {
+            perror ("Malloc");
+            return 0;
+        }
+        PHASE_PROFILE *profile = (PHASE_PROFILE *) ring;
+        memset (profile, 0, sizeof (PHASE_PROFILE));
+        for (c = 0; c < NUM_COUNTERS; c++) {
+            profile->counter_fd[c] = -1;
+            if (!use_counters)
+                continue;
+            struct perf_event_attr attr;
+            memset (&attr, 0, sizeof (attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof (attr);
+            attr.config = counter_config[c];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            profile->counter_fd[c] = (int) syscall (SYS_perf_event_open, &attr, targs->kernel_tid, -1, -1, 0);
+        }
+
+        /* The workers are parked on start_barrier, which orders this store 
+         * before their next job */
+        targs->profile = profile;
+    }
+
+    return 1;
+}
+
+/* Print the mean duration of each phase per worker over the recorded sorts, 
+ * the barrier waits between them, and the load imbalance of each working 
+ * phase as the slowest worker's time over the mean. Counter tables follow 
+ * when counters are open. */
+void
+sorter_print_profile (SORTER *sorter, FILE *out)
+{
+    static const char *phase_name[NUM_MARKS - 1] = { "count", "wait", "reduce", "wait", "prefix", "wait", "fill" };
+    static const char *counter_name[NUM_COUNTERS] = { "Cycles", "LLC misses" };
+    int num_threads = sorter->num_threads;
+    int i, k, c;
+    long s;
+
+    PHASE_PROFILE *first = sorter->args_for_thread[0].profile;
+    if (first == NULL || first->num_sorts == 0) {
+        fprintf (out, "No profiled sorts\n");
+        return;
+    }
+    long num_samples = (first->num_sorts < PROFILE_SAMPLES) ? first->num_sorts : PROFILE_SAMPLES;
+
+    /* Mean per sort of each phase for each worker: time in microseconds, then the counters */
+    double (*mean)[NUM_COUNTERS + 1][NUM_MARKS - 1] =
+        calloc (num_threads, sizeof (double [NUM_COUNTERS + 1][NUM_MARKS - 1]));
+    if (mean == NULL) {
+        perror ("Malloc");
+        return;
+    }
+    for (i = 0; i < num_threads; i++) {
+        const PHASE_PROFILE *profile = sorter->args_for_thread[i].profile;
+        for (s = 0; s < num_samples; s++) {
+            const PHASE_SAMPLE *sample = &profile->sample[s];
+            for (k = 0; k < NUM_MARKS - 1; k++) {
+                mean[i][0][k] += (sample->ns[k + 1] - sample->ns[k]) / 1e3 / num_samples;
+                for (c = 0; c < NUM_COUNTERS; c++)
+                    mean[i][c + 1][k] += (double) (sample->counter[c][k + 1] - sample->counter[c][k]) / num_samples;
+            }
+        }
+    }
+
+    for (c = 0; c <= NUM_COUNTERS; c++) {
+        if (c > 0 && first->counter_fd[c - 1] < 0)
+            continue;
+        fprintf (out, "\n%s per sort, mean of the last %ld sorts\n", (c == 0) ? "Microseconds" : counter_name[c - 1], num_samples);
+        fprintf (out, "thread");
+        for (k = 0; k < NUM_MARKS - 1; k++)
+            fprintf (out, " %12s", phase_name[k]);
+        fprintf (out, "\n");
+        for (i = 0; i < num_threads; i++) {
+            fprintf (out, "%6d", i);
+            for (k = 0; k < NUM_MARKS - 1; k++)
+                fprintf (out, (c == 0) ? " %12.1f" : " %12.0f", mean[i][c][k]);
+            fprintf (out, "\n");
+        }
+    }
+
+    /* Load imbalance of the working phases; the waits show where it is paid for */
+    fprintf (out, "\nphase          mean us       max us  slowest   max/mean\n");
+    for (k = 0; k < NUM_MARKS - 1; k += 2) {
+        double sum = 0, max = 0;
+        int slowest = 0;
+        for (i = 0; i < num_threads; i++) {
+            sum += mean[i][0][k];
+            if (mean[i][0][k] > max) {
+                max = mean[i][0][k];
+                slowest = i;
+            }
+        }
+        double average = sum / num_threads;
+        fprintf (out, "%-8s %12.1f %12.1f %8d %10.2f\n", phase_name[k], average, max, slowest,
+                 (average > 0) ? max / average : 1.0);
+    }
+
+    free (mean);
+}
+
+/* Size the counting tiles of the next job and rewind the cursor. The workers 
+ * read both after start_barrier. */
+void
+set_count_tiles (SORTER *sorter, int num_elements)
+{
+    long tile = COUNT_TILE;
+    if (sorter->threads_per_shard == 0 && (long) sorter->num_bins * TILE_ELEMENTS_PER_BIN > tile)
+        tile = (long) sorter->num_bins * TILE_ELEMENTS_PER_BIN;
+    /* Shrink the tiles until every worker has TILES_PER_WORKER of them to claim, 
+     * keeping them whole cache lines of keys */
+    long min_tile = CACHE_LINE_SIZE / sizeof (int);
+    long num_tiles = (long) TILES_PER_WORKER * sorter->num_threads;
+    if (tile * num_tiles > num_elements)
+        tile = (num_elements / num_tiles) / min_tile * min_tile;
+    sorter->tile_elements = (tile > min_tile) ? (int) tile : (int) min_tile;
+    sorter->tile_cursor = 0;
+}
+
+/* Count and prefix-sum num_elements keys on the pool without writing them out, 
+ * and describe the sorted order as runs in view. The view points into the 
+ * sorter and stays valid until its next job. */
+void
+sorter_sort_runs (SORTER *sorter, const int *input_array, int num_elements, RUN_VIEW *view)
+{
+    int i;
+    for (i = 0; i < sorter->num_threads; i++) {
+        sorter->args_for_thread[i].num_elements = num_elements;
+        sorter->args_for_thread[i].input_array = (int *) input_array;
+        sorter->args_for_thread[i].sorted = NULL;
+        sorter->args_for_thread[i].payload = NULL;
+        sorter->args_for_thread[i].prefix_only = 1;
+    }
+    set_count_tiles (sorter, num_elements);
+
+    pthread_barrier_wait (&sorter->start_barrier);   /* Release the workers */
+    pthread_barrier_wait (&sorter->done_barrier);    /* Wait for the workers to finish */
+
+    for (i = 0; i < sorter->num_threads; i++)
+        sorter->args_for_thread[i].prefix_only = 0;
+
+    view->min_value = sorter->min_value;
+    view->num_bins = sorter->num_bins;
+    view->num_elements = num_elements;
+    view->count = sorter->global_bin;
+    view->offset = sorter->bin_offset;
+    view->fill_kernel = sorter->fill_kernel;
+}
+
+/* Key at position idx of the sorted order, in O(log num_bins). */
+int
+run_view_key (const RUN_VIEW *view, int idx)
+{
+    return view->min_value + find_bin (view->offset, view->num_bins, idx);
+}
+
+/* Write positions [first, first + count) of the sorted order into dst. */
+void
+run_view_materialize (const RUN_VIEW *view, int first, int count, int *dst)
+{
+    int stop = first + count;
+    int idx = first;
+    int i = find_bin (view->offset, view->num_bins, first);
+    while (idx < stop) {
+        int run_stop = (view->offset[i + 1] < stop) ? view->offset[i + 1] : stop;
+        view->fill_kernel (dst + (idx - first), view->min_value + i, run_stop - idx, 0);
+        idx = run_stop;
+        i++;
+    }
+}
+
+/* Position a cursor before the first key of the view. */
+void
+run_cursor_init (RUN_CURSOR *cursor, const RUN_VIEW *view)
+{
+    cursor->view = view;
+    cursor->bin = -1;
+    cursor->remaining = 0;
+}
+
+/* Advance to the next non-empty run and return its key and length, skipping 
+ * any keys of the current run not yet read. Returns 0 at the end. */
+int
+run_cursor_next_run (RUN_CURSOR *cursor, int *key, int *count)
+{
+    const RUN_VIEW *view = cursor->view;
+    do {
+        if (++cursor->bin >= view->num_bins) {
+            cursor->remaining = 0;
+            return 0;
+        }
+    } while (view->count[cursor->bin] == 0);
+
+    *key = view->min_value + cursor->bin;
+    *count = view->count[cursor->bin];
+    cursor->remaining = 0;
+    return 1;
+}
+
+/* Return the next key in sorted order in *key. Returns 0 at the end. */
+int
+run_cursor_next (RUN_CURSOR *cursor, int *key)
+{
+    if (cursor->remaining == 0) {
+        int count;
+        if (!run_cursor_next_run (cursor, key, &count))
+            return 0;
+        cursor->remaining = count;
+    }
+    cursor->remaining--;
+    *key = cursor->view->min_value + cursor->bin;
+    return 1;
+}
+
+/* Round a histogram row up to a whole number of cache lines. */
+int
+padded_row_length (int num_bins)
+{
+    int ints_per_line = CACHE_LINE_SIZE / sizeof (int);
+    return ((num_bins + ints_per_line - 1) / ints_per_line) * ints_per_line;
+}
+
+/* Retire the workers and free the sorter. A caller's arena is left to the caller. */
+void
+sorter_destroy (SORTER *sorter)
+{
+    int i;
+    if (sorter == NULL)
+        return;
+
+    sorter->shutdown = 1;
+    pthread_barrier_wait (&sorter->start_barrier);
+    for (i = 0; i < sorter->num_threads; i++)
+        pthread_join (sorter->tid[i], NULL);
+
+    for (i = 0; i < sorter->num_threads; i++) {
+        PHASE_PROFILE *profile = sorter->args_for_thread[i].profile;
+        if (profile == NULL)
+            continue;
+        for (int c = 0; c < NUM_COUNTERS; c++)
+            if (profile->counter_fd[c] >= 0)
+                close (profile->counter_fd[c]);
+        free (profile);
+    }
+
+    destroy_barriers (sorter, NUM_BARRIERS);
+    pthread_mutex_destroy (&sorter->launch);
+
+    /* Everything else lives in the arena, including the sorter itself */
+    free (sorter->owned_arena);
+}
+
+/* Create an incremental sorter for keys in [min_value, max_value], holding no 
+ * keys, with a pool of num_threads workers for loading. Returns NULL on failure. */
+INCREMENTAL_SORTER *
+incremental_create (int num_threads, int min_value, int max_value)
+{
+    INCREMENTAL_SORTER *inc = (INCREMENTAL_SORTER *) malloc (sizeof (INCREMENTAL_SORTER));
+    if (inc == NULL) {
+        perror ("Malloc");
+        return NULL;
+    }
+    inc->min_value = min_value;
+    inc->max_value = max_value;
+    inc->num_bins = max_value - min_value + 1;
+    inc->bin = (int *) calloc (inc->num_bins, sizeof (int));
+    inc->bin_offset = (int *) calloc (inc->num_bins + 1, sizeof (int));
+    inc->sorted = NULL;
+    inc->num_elements = 0;
+    inc->capacity = 0;
+    inc->dirty_low = inc->num_bins;
+    inc->dirty_high = -1;
+    inc->fill_kernel = select_fill_kernel ();
+    inc->pool = sorter_create (num_threads, min_value, max_value);
+    if (inc->bin == NULL || inc->bin_offset == NULL || inc->pool == NULL) {
+        perror ("Malloc");
+        incremental_destroy (inc);
+        return NULL;
+    }
+    return inc;
+}
+
+/* Make room for at least num_elements sorted keys, keeping the current ones. */
+static int
+incremental_reserve (INCREMENTAL_SORTER *inc, int num_elements)
+{
+    if (num_elements <= inc->capacity)
+        return 1;
+    int capacity = (inc->capacity > 0) ? inc->capacity : 1024;
+    while (capacity < num_elements)
+        capacity = (capacity > INT_MAX / 2) ? INT_MAX : 2 * capacity;
+    int *sorted = (int *) realloc (inc->sorted, capacity * sizeof (int));
+    if (sorted == NULL) {
+        perror ("Malloc");
+        return 0;
+    }
+    inc->sorted = sorted;
+    inc->capacity = capacity;
+    return 1;
+}
+
+/* Replace the contents with the num_elements keys of input_array, sorting them 
+ * on the pool. Returns 1 on success. */
+int
+incremental_load (INCREMENTAL_SORTER *inc, int *input_array, int num_elements)
+{
+    if (!incremental_reserve (inc, num_elements))
+        return 0;
+    sorter_sort (inc->pool, input_array, inc->sorted, num_elements);
+    memcpy (inc->bin, inc->pool->global_bin, inc->num_bins * sizeof (int));
+    memcpy (inc->bin_offset, inc->pool->bin_offset, (inc->num_bins + 1) * sizeof (int));
+    inc->num_elements = num_elements;
+    inc->dirty_low = inc->num_bins;
+    inc->dirty_high = -1;
+    return 1;
+}
+
+/* Apply num_deltas changes to the counts, in O(num_deltas). The sorted output 
+ * catches up on the next incremental_refresh (). Stops at the first delta 
+ * with a key out of range or that removes a key not present, and returns 
+ * the number of deltas applied. */
+int
+incremental_apply (INCREMENTAL_SORTER *inc, const DELTA *deltas, int num_deltas)
+{
+    int i;
+    for (i = 0; i < num_deltas; i++) {
+        int remove = (deltas[i].op == DELTA_DELETE || deltas[i].op == DELTA_UPDATE) ? deltas[i].key - inc->min_value : -1;
+        int add = (deltas[i].op == DELTA_INSERT) ? deltas[i].key - inc->min_value
+                  : (deltas[i].op == DELTA_UPDATE) ? deltas[i].new_key - inc->min_value : -1;
+        if ((deltas[i].op != DELTA_INSERT && (remove < 0 || remove >= inc->num_bins || inc->bin[remove] == 0))
+            || (deltas[i].op != DELTA_DELETE && (add < 0 || add >= inc->num_bins))
+            || (deltas[i].op == DELTA_INSERT && inc->num_elements == INT_MAX))
+            break;
+
+        if (remove >= 0) {
+            inc->bin[remove]--;
+            inc->num_elements--;
+            inc->dirty_low = (remove < inc->dirty_low) ? remove : inc->dirty_low;
+            inc->dirty_high = (remove > inc->dirty_high) ? remove : inc->dirty_high;
+        }
+        if (add >= 0) {
+            inc->bin[add]++;
+            inc->num_elements++;
+            inc->dirty_low = (add < inc->dirty_low) ? add : inc->dirty_low;
+            inc->dirty_high = (add > inc->dirty_high) ? add : inc->dirty_high;
+        }
+    }
+    return i;
+}
+
+/* Bring the prefix sums and the sorted output up to date with the counts and 
+ * return the sorted keys, valid until the next call, or NULL on failure. Only 
+ * bins from the lowest changed one are revisited: up to the highest changed 
+ * one when the number of keys is unchanged, as the later bins keep their 
+ * place, and to the end otherwise. */
+const int *
+incremental_refresh (INCREMENTAL_SORTER *inc)
+{
+    int i;
+    if (inc->dirty_low > inc->dirty_high)
+        return inc->sorted;
+    if (!incremental_reserve (inc, inc->num_elements))
+        return NULL;
+
+    int low = inc->dirty_low;
+    int high = (inc->bin_offset[inc->num_bins] == inc->num_elements) ? inc->dirty_high : inc->num_bins - 1;
+    for (i = low; i <= high; i++)
+        inc->bin_offset[i + 1] = inc->bin_offset[i] + inc->bin[i];
+    for (i = low; i <= high; i++)
+        inc->fill_kernel (inc->sorted + inc->bin_offset[i], inc->min_value + i, inc->bin[i], 0);
+
+    inc->dirty_low = inc->num_bins;
+    inc->dirty_high = -1;
+    return inc->sorted;
+}
+
+void
+incremental_destroy (INCREMENTAL_SORTER *inc)
+{
+    if (inc == NULL)
+        return;
+    sorter_destroy (inc->pool);
+    free (inc->bin);
+    free (inc->bin_offset);
+    free (inc->sorted);
+    free (inc);
+}
+
+/* Worker loop: park until a job is released, run it, report completion. */
+void *
+sorter_worker (void *args)
+{
+    ARGS_FOR_THREAD *targs = (ARGS_FOR_THREAD *) args;
+    SORTER *sorter = targs->sorter;
+    targs->kernel_tid = (pid_t) syscall (SYS_gettid);
+
+    /* Wait until sorter_init () has created every worker; if it could not, leave */
+    pthread_mutex_lock (&sorter->launch);
+    pthread_mutex_unlock (&sorter->launch);
+    if (sorter->shutdown)
+        return NULL;
+
+    /* Clear this worker's histogram row and its sub-histogram scratch rows from 
+     * the worker itself, so that the first touch, and therefore the backing 
+     * page, is local to its node. In a sharded sorter the first worker of each 
+     * group clears the group's shard instead. */
+    if (sorter->threads_per_shard == 0)
+        memset (sorter->tbin[targs->tid], 0, (size_t) (1 + sorter->scratch_rows) * sorter->tbin_stride * sizeof (int));
+    else if (targs->tid % sorter->threads_per_shard == 0)
+        memset (sorter->shard[targs->tid / sorter->threads_per_shard], 0, sorter->tbin_stride * sizeof (int));
+    pthread_barrier_wait (&sorter->done_barrier);
+
+    while (1) {
+        pthread_barrier_wait (&sorter->start_barrier);
+        if (sorter->shutdown)
+            break;
+
+        if (targs->radix != NULL)
+            thread_radix_sort (targs);
+        else
+            thread_sort (targs);
+        pthread_barrier_wait (&sorter->done_barrier);
+    }
+
+    free (targs->wc_buffer);
+    free (targs->wc_fill);
+    pthread_exit ((void *) 0);
+}
+
+/* Timestamp a mark of the current sort in this worker's profile ring, reading
+ * the hardware counters when they are open. MARK_FILL completes the sample. */
+static inline void
+profile_mark (ARGS_FOR_THREAD *targs, int mark)
+{
+    PHASE_PROFILE *profile = targs->profile;
+    if (profile == NULL)
+        return;
+
+    PHASE_SAMPLE *sample = &profile->sample[profile->num_sorts % PROFILE_SAMPLES];
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    sample->ns[mark] = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        uint64_t value = 0;
+        if (profile->counter_fd[c] >= 0 && read (profile->counter_fd[c], &value, sizeof (value)) != sizeof (value))
+            value = 0;
+        sample->counter[c][mark] = value;
+    }
+    if (mark == MARK_FILL)
+        profile->num_sorts++;
+}
+
+void *
+thread_sort(void *args)
+{
+    int idx = 0;
+    /* Unpack Args */
+    ARGS_FOR_THREAD *targs = (ARGS_FOR_THREAD *) args;
+
+    int num_bins = targs->range + 1;
+    int *my_bin = targs->tbin[targs->tid];
+    SORTER *sorter = targs->sorter;
+    profile_mark (targs, MARK_START);
+
+    /* The bins are reused between sorts, so clear this thread's histogram and 
+     * the scratch rows its kernel counts into first. Shards are cleared by the 
+     * reduction of the previous sort instead. */
+    if (sorter->threads_per_shard == 0)
+        memset (my_bin, 0, (size_t) (1 + sorter->scratch_rows) * sorter->tbin_stride * sizeof (int));
+
+    /* Each thread's contiguous chunk of the input */
+    int chunk_el = floor(targs->num_elements/targs->num_threads);
+    int mystart = targs->tid*chunk_el;
+    int mystop = (targs->tid + 1)*chunk_el;
+    if (targs->tid == (targs->num_threads - 1)) /* This takes care of the number of elements that the final thread must process */
+        mystop = targs->num_elements;
+    if (targs->payload != NULL && targs->payload->layout == PAYLOAD_AOS) {
+        const char *record = (const char *) targs->payload->src + targs->payload->key_offset;
+        for (int i = mystart; i < mystop; i++) {
+            int key;
+            memcpy (&key, record + (size_t) i * targs->payload->size, sizeof (int));
+            my_bin[key - targs->min_value]++;
+        }
+    }
+    else if (targs->payload != NULL) {
+        sorter->histogram_kernel (targs->input_array + mystart, mystop - mystart, my_bin, num_bins, targs->min_value, targs->scratch);
+    }
+    else {
+        /* Without a payload the order of counting does not matter, so workers 
+         * claim tiles from a shared cursor and faster cores count more of them. 
+         * The stable pair sort keeps the fixed chunks, which its scatter relies on. */
+        int tile_elements = sorter->tile_elements;
+        int tile;
+        while ((tile = __atomic_fetch_add (&sorter->tile_cursor, 1, __ATOMIC_RELAXED))
+               < (targs->num_elements + tile_elements - 1) / tile_elements) {
+            int tile_start = tile * tile_elements;
+            int count = (targs->num_elements - tile_start < tile_elements) ? targs->num_elements - tile_start : tile_elements;
+            if (sorter->threads_per_shard > 0)
+                histogram_atomic (targs->input_array + tile_start, count,
+                                  sorter->shard[targs->tid / sorter->threads_per_shard], num_bins, targs->min_value, NULL);
+            else
+                sorter->histogram_kernel (targs->input_array + tile_start, count, my_bin, num_bins, targs->min_value, targs->scratch);
+        }
+    }
+    if (targs->scratch != NULL)
+        histogram_fold (my_bin, num_bins, targs->scratch, sorter->scratch_rows);
+    profile_mark (targs, MARK_COUNT);
+    pthread_barrier_wait(targs->barrier);
+    profile_mark (targs, MARK_BARRIER);
+
+    /* Each thread reduces its own range of bins, overwriting the previous sort's counts, 
+     * and records how many elements its range holds */
+    int bin_stop = (targs->tid < (targs->num_threads - 1)) ? (targs->offset + targs->chunk_size) : num_bins;
+    int block_sum = 0;
+    for (int i = targs->offset; i < bin_stop; i++) {
+        int sum = 0;
+        if (sorter->threads_per_shard > 0) {
+            /* Leave the shards clear for the next sort */
+            for (int j = 0; j < sorter->num_shards; j++) {
+                sum += sorter->shard[j][i];
+                sorter->shard[j][i] = 0;
+            }
+        }
+        else if (targs->payload == NULL) {
+            for (int j = 0; j < targs->num_threads; j++)
+                sum += targs->tbin[j][i];
+        }
+        else { 
+            /* A stable sort also needs each thread's position within the bin, so 
+             * turn the per-thread counts into an exclusive scan across threads */
+            for (int j = 0; j < targs->num_threads; j++) {
+                int count = targs->tbin[j][i];
+                targs->tbin[j][i] = sum;
+                sum += count;
+            }
+        }
+        targs->global_bin[i] = sum;
+        block_sum += sum;
+    }
+    targs->block_sum[targs->tid] = block_sum;
+
+    profile_mark (targs, MARK_REDUCE);
+    pthread_barrier_wait(targs->barrier2);
+    profile_mark (targs, MARK_BARRIER2);
+    if (targs->histogram_only) {
+        profile_mark (targs, MARK_PREFIX);
+        profile_mark (targs, MARK_BARRIER3);
+        profile_mark (targs, MARK_FILL);
+        return NULL;
+    }
+
+    /* Exclusive prefix sum over the global histogram: offset this thread's 
+     * bin range by the totals of the ranges before it, then scan the range */
+    for (int j = 0; j < targs->tid; j++)
+        idx += targs->block_sum[j];
+    for (int i = targs->offset; i < bin_stop; i++) {
+        targs->bin_offset[i] = idx;
+        idx += targs->global_bin[i];
+    }
+    if (targs->tid == (targs->num_threads - 1))
+        targs->bin_offset[num_bins] = idx;
+
+    profile_mark (targs, MARK_PREFIX);
+    pthread_barrier_wait(targs->barrier3);
+    profile_mark (targs, MARK_BARRIER3);
+    if (targs->prefix_only) {
+        profile_mark (targs, MARK_FILL);
+        return NULL;
+    }
+
+    if (targs->payload != NULL) {
+        scatter_pairs (targs, mystart, mystop);
+        profile_mark (targs, MARK_FILL);
+        return NULL;
+    }
+
+    /* Generate the sorted array. Each thread writes an equal share of the output, 
+     * whatever the key distribution, starting in the bin that covers its first index. */
+    int out_start = (int) ((long) targs->tid * targs->num_elements / targs->num_threads);
+    int out_stop = (int) ((long) (targs->tid + 1) * targs->num_elements / targs->num_threads);
+    int streaming = ((long) targs->num_elements * sizeof (int) > targs->sorter->llc_bytes);
+    int i = find_bin (targs->bin_offset, num_bins, out_start);
+    idx = out_start;
+    while (idx < out_stop) {
+        int run_stop = (targs->bin_offset[i + 1] < out_stop) ? targs->bin_offset[i + 1] : out_stop;
+        targs->sorter->fill_kernel (targs->sorted + idx, targs->min_value + i, run_stop - idx, streaming);
+        idx = run_stop;
+        i++;
+    }
+    if (streaming)
+        _mm_sfence ();
+    profile_mark (targs, MARK_FILL);
+
+    return NULL;
+}
+
+/* Specialized counting sorts for unsigned 8-, 16- and 32-bit keys. */
+DEFINE_COUNTING_SORT_DISPATCH (counting_sort_u8, uint8_t)
+DEFINE_COUNTING_SORT_DISPATCH (counting_sort_u16, uint16_t)
+DEFINE_COUNTING_SORT_DISPATCH (counting_sort_u32, uint32_t)
+
+/* Input generation. The output is produced in blocks of GENERATOR_BLOCK keys
+ * and every block seeds its own xoshiro256** stream from (seed, block index),
+ * so the same seed gives the same array whatever the number of threads.
+ * Threads take blocks round-robin. */
+
+static inline uint64_t
+splitmix64 (uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t
+rotl64 (uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t
+xoshiro256ss (uint64_t *s)
+{
+    uint64_t result = rotl64 (s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl64 (s[3], 45);
+    return result;
+}
+
+/* Parse a distribution name, optionally followed by ":exponent" for zipf.
+ * Returns -1 for an unknown name. */
+int
+parse_distribution (const char *name, double *zipf_exponent)
+{
+    if (strcmp (name, "uniform") == 0)
+        return DIST_UNIFORM;
+    if (strncmp (name, "zipf", 4) == 0 && (name[4] == '\0' || name[4] == ':')) {
+        *zipf_exponent = (name[4] == ':') ? atof (name + 5) : ZIPF_EXPONENT;
+        return DIST_ZIPF;
+    }
+    if (strcmp (name, "sorted") == 0)
+        return DIST_SORTED;
+    if (strcmp (name, "reverse") == 0)
+        return DIST_REVERSE;
+    if (strcmp (name, "equal") == 0)
+        return DIST_EQUAL;
+    return -1;
+}
+
+/* Fill the blocks of one generator thread. */
+void *
+generator_thread (void *args)
+{
+    GENERATOR_ARGS *gargs = (GENERATOR_ARGS *) args;
+    const GENERATOR *gen = gargs->gen;
+    uint64_t random[GENERATOR_BATCH];
+    long num_elements = gen->num_elements;
+    uint64_t num_keys = (uint64_t) ((uint32_t) gen->max_value - (uint32_t) gen->min_value) + 1;   /* Up to 2^32 */
+    uint32_t min_value = (uint32_t) gen->min_value;
+    int num_blocks = (int) ((num_elements + GENERATOR_BLOCK - 1) / GENERATOR_BLOCK);
+
+    for (int block = gargs->tid; block < num_blocks; block += gen->num_threads) {
+        long start = (long) block * GENERATOR_BLOCK;
+        long stop = (start + GENERATOR_BLOCK < num_elements) ? start + GENERATOR_BLOCK : num_elements;
+        int *out = gen->input_array;
+
+        switch (gen->distribution) {
+            case DIST_UNIFORM:
+            case DIST_ZIPF: {
+                uint64_t state = gen->seed ^ ((uint64_t) block * 0xd1b54a32d192ed03ULL);
+                uint64_t s[4];
+                for (int k = 0; k < 4; k++)
+                    s[k] = splitmix64 (&state);
+
+                for (long i = start; i < stop; i += GENERATOR_BATCH) {
+                    int n = (stop - i < GENERATOR_BATCH) ? (int) (stop - i) : GENERATOR_BATCH;
+                    for (int j = 0; j < n; j++)
+                        random[j] = xoshiro256ss (s);
+
+                    if (gen->distribution == DIST_UNIFORM) {
+                        /* Multiply-shift maps 32 random bits onto [0, num_keys) without a
+                         * division; this loop vectorizes. Unsigned sums keep the full
+                         * int range from overflowing. */
+                        for (int j = 0; j < n; j++)
+                            out[i + j] = (int) (min_value + (uint32_t) (((random[j] >> 32) * num_keys) >> 32));
+                    }
+                    else {
+                        /* Invert the Zipf CDF by binary search; rank 0 is min_value */
+                        for (int j = 0; j < n; j++) {
+                            double u = (random[j] >> 11) * 0x1.0p-53;
+                            uint32_t low = 0, high = (uint32_t) (num_keys - 1);
+                            while (low < high) {
+                                uint32_t mid = low + (high - low) / 2;
+                                if (gen->zipf_cdf[mid] <= u)
+                                    low = mid + 1;
+                                else
+                                    high = mid;
+                            }
+                            out[i + j] = (int) (min_value + low);
+                        }
+                    }
+                }
+                break;
+            }
+
+            case DIST_SORTED:
+                for (long i = start; i < stop; i++)
+                    out[i] = (int) (min_value + (uint32_t) ((i * num_keys) / num_elements));
+                break;
+
+            case DIST_REVERSE:
+                for (long i = start; i < stop; i++)
+                    out[i] = (int) ((uint32_t) gen->max_value - (uint32_t) ((i * num_keys) / num_elements));
+                break;
+
+            case DIST_EQUAL:
+                for (long i = start; i < stop; i++)
+                    out[i] = gen->min_value;
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+/* Fill input_array with num_elements keys in [min_value, max_value] drawn from
+ * the given distribution, using num_threads threads. The result depends only
+ * on the seed, not on the number of threads. Returns 1 on success. */
+int
+generate_input (int *input_array, int num_elements, int min_value, int max_value,
+                int distribution, double zipf_exponent, uint64_t seed, int num_threads)
+{
+    int i;
+    GENERATOR gen;
+    gen.input_array = input_array;
+    gen.num_elements = num_elements;
+    gen.min_value = min_value;
+    gen.max_value = max_value;
+    gen.distribution = distribution;
+    gen.seed = seed;
+    gen.num_threads = (num_threads > 0) ? num_threads : 1;
+    gen.zipf_cdf = NULL;
+
+    if (distribution == DIST_ZIPF) {
+        /* P(rank k) is proportional to 1 / (k + 1)^exponent */
+        int num_keys = max_value - min_value + 1;
+        gen.zipf_cdf = (double *) malloc (num_keys * sizeof (double));
+        if (gen.zipf_cdf == NULL) {
+            perror ("Malloc");
+            return 0;
+        }
+        double sum = 0;
+        for (i = 0; i < num_keys; i++) {
+            sum += 1.0 / pow (i + 1, zipf_exponent);
+            gen.zipf_cdf[i] = sum;
+        }
+        for (i = 0; i < num_keys; i++)
+            gen.zipf_cdf[i] /= sum;
+        gen.zipf_cdf[num_keys - 1] = 1.0;
+    }
+
+    pthread_t *tid = (pthread_t *) malloc (gen.num_threads * sizeof (pthread_t));
+    GENERATOR_ARGS *args = (GENERATOR_ARGS *) malloc (gen.num_threads * sizeof (GENERATOR_ARGS));
+    if (tid == NULL || args == NULL) {
+        perror ("Malloc");
+        free (gen.zipf_cdf);
+        free (tid);
+        free (args);
+        return 0;
+    }
+    for (i = 0; i < gen.num_threads; i++) {
+        args[i].tid = i;
+        args[i].gen = &gen;
+        int error = pthread_create (&tid[i], NULL, generator_thread, (void *) &args[i]);
+        if (error != 0) {
+            errno = error;
+            perror ("pthread_create");
+            break;
+        }
+    }
+    int num_created = i;
+    for (i = 0; i < num_created; i++)
+        pthread_join (tid[i], NULL);
+
+    free (gen.zipf_cdf);
+    free (tid);
+    free (args);
+    return (num_created == gen.num_threads);
+}
+
+/* Return the last bin whose starting output index is at or before idx. */
+int
+find_bin (const int *bin_offset, int num_bins, int idx)
+{
+    int low = 0, high = num_bins - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (bin_offset[mid] <= idx)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
+}
+
+/* Stable scatter for sorter_sort_pairs (). The thread walks its own input chunk 
+ * in order; each key goes to the next free slot of its bin, which starts at the 
+ * bin's global offset plus the number of equal keys in earlier chunks. That 
+ * count is in the thread's own row after the reduction, and the row becomes 
+ * the cursors in place; the next sort clears it. */
+void
+scatter_pairs (ARGS_FOR_THREAD *targs, int mystart, int mystop)
+{
+    int i;
+    int num_bins = targs->range + 1;
+    int *cursor = targs->tbin[targs->tid];
+    PAYLOAD *payload = targs->payload;
+    size_t size = payload->size;
+
+    for (i = 0; i < num_bins; i++)
+        cursor[i] += targs->bin_offset[i];
+
+    switch (payload->layout) {
+        case PAYLOAD_SOA: {
+            const char *src = (const char *) payload->src;
+            char *dst = (char *) payload->dst;
+            for (i = mystart; i < mystop; i++) {
+                int key = targs->input_array[i];
+                int pos = cursor[key - targs->min_value]++;
+                if (targs->sorted != NULL)
+                    targs->sorted[pos] = key;
+                memcpy (dst + (size_t) pos * size, src + (size_t) i * size, size);
+            }
+            break;
+        }
+
+        case PAYLOAD_AOS: {
+            const char *src = (const char *) payload->src;
+            char *dst = (char *) payload->dst;
+            for (i = mystart; i < mystop; i++) {
+                int key;
+                memcpy (&key, src + (size_t) i * size + payload->key_offset, sizeof (int));
+                int pos = cursor[key - targs->min_value]++;
+                if (targs->sorted != NULL)
+                    targs->sorted[pos] = key;
+                memcpy (dst + (size_t) pos * size, src + (size_t) i * size, size);
+            }
+            break;
+        }
+
+        case PAYLOAD_INDEX: {
+            int *permutation = (int *) payload->dst;
+            for (i = mystart; i < mystop; i++) {
+                int key = targs->input_array[i];
+                int pos = cursor[key - targs->min_value]++;
+                if (targs->sorted != NULL)
+                    targs->sorted[pos] = key;
+                permutation[pos] = i;
+            }
+            break;
+        }
+    }
+}
+
+/* Create a sorter whose histogram rows are wide enough for one radix digit. */
+SORTER *
+sorter_create_radix (int num_threads)
+{
+    return sorter_create (num_threads, 0, RADIX_BINS - 1);
+}
+
+/* Sort num_elements unsigned keys of key_bytes (4 or 8) bytes in place with a
+ * parallel LSD radix sort. buffer must hold num_elements keys and is used as the
+ * other half of the ping-pong. Returns 0 if the sorter's rows are narrower than
+ * a digit, the sorter is sharded, or the key width is not supported. */
+static int
+sorter_radix_sort (SORTER *sorter, void *keys, void *buffer, int num_elements, int key_bytes)
+{
+    int i;
+    if (sorter->num_bins < RADIX_BINS || sorter->threads_per_shard > 0 || (key_bytes != 4 && key_bytes != 8))
+        return 0;
+
+    RADIX_JOB job;
+    job.key_bytes = key_bytes;
+    job.keys = keys;
+    job.buffer = buffer;
+    job.skip = 0;
+
+    for (i = 0; i < sorter->num_threads; i++) {
+        sorter->args_for_thread[i].num_elements = num_elements;
+        sorter->args_for_thread[i].input_array = NULL;
+        sorter->args_for_thread[i].sorted = NULL;
+        sorter->args_for_thread[i].payload = NULL;
+        sorter->args_for_thread[i].radix = &job;
+    }
+
+    pthread_barrier_wait (&sorter->start_barrier);   /* Release the workers */
+    pthread_barrier_wait (&sorter->done_barrier);    /* Wait for the workers to finish */
+
+    for (i = 0; i < sorter->num_threads; i++)
+        sorter->args_for_thread[i].radix = NULL;
+    return 1;
+}
+
+int
+sorter_radix_sort_u32 (SORTER *sorter, uint32_t *keys, uint32_t *buffer, int num_elements)
+{
+    return sorter_radix_sort (sorter, keys, buffer, num_elements, sizeof (uint32_t));
+}
+
+int
+sorter_radix_sort_u64 (SORTER *sorter, uint64_t *keys, uint64_t *buffer, int num_elements)
+{
+    return sorter_radix_sort (sorter, keys, buffer, num_elements, sizeof (uint64_t));
+}
+
+/* Write one staged cache line to an aligned line of the output with
+ * non-temporal stores, which skip the read for ownership and leave the
+ * cache to the keys still being scattered. */
+static inline void
+stream_line (void *dst, const void *line)
+{
+#ifdef __AVX512F__
+    _mm512_stream_si512 ((__m512i *) dst, _mm512_load_si512 (line));
+#else
+    for (int k = 0; k < CACHE_LINE_SIZE / 16; k++)
+        _mm_stream_si128 ((__m128i *) dst + k, _mm_load_si128 ((const __m128i *) line + k));
+#endif
+}
+
+/* Per-worker LSD radix sort for one key type. Every pass runs the same phases
+ * as thread_sort: a private digit histogram in tbin, the per-bin reduction
+ * (with an exclusive scan across threads, as for stable pair sorts), the
+ * prefix sum into bin_offset, and a stable scatter of the thread's chunk.
+ * A pass whose digit is the same for every key is detected during the
+ * reduction and skipped. The scatter stages keys in one cache line per bin
+ * and writes a full, aligned line at a time. */
+#define DEFINE_RADIX_WORKER(name, key_t)                                            \
+void                                                                                \
+name (ARGS_FOR_THREAD *targs)                                                       \
+{                                                                                   \
+    RADIX_JOB *job = targs->radix;                                                  \
+    int i, b;                                                                       \
+    int num_bins = targs->range + 1;                                                \
+    int num_elements = targs->num_elements;                                         \
+    int *my_bin = targs->tbin[targs->tid];                                          \
+    int *cursor = my_bin;           /* Turned into cursors in place each pass */   \
+    const int wc_keys = CACHE_LINE_SIZE / sizeof (key_t);                           \
+    key_t *wc = (key_t *) targs->wc_buffer;                                         \
+    int *wc_fill = targs->wc_fill;                                                  \
+                                                                                    \
+    int chunk_el = num_elements / targs->num_threads;                               \
+    int mystart = targs->tid * chunk_el;                                            \
+    int mystop = (targs->tid == (targs->num_threads - 1)) ? num_elements : mystart + chunk_el; \
+    int bin_stop = (targs->tid < (targs->num_threads - 1)) ? (targs->offset + targs->chunk_size) : num_bins; \
+                                                                                    \
+    key_t *src = (key_t *) job->keys;                                               \
+    key_t *dst = (key_t *) job->buffer;                                             \
+    int num_passes = (int) ((sizeof (key_t) * 8 + RADIX_BITS - 1) / RADIX_BITS);    \
+                                                                                    \
+    for (int pass = 0; pass < num_passes; pass++) {                                 \
+        int shift = pass * RADIX_BITS;                                              \
+                                                                                    \
+        memset (my_bin, 0, num_bins * sizeof (int));                                \
+        for (i = mystart; i < mystop; i++)                                          \
+            my_bin[(src[i] >> shift) & (RADIX_BINS - 1)]++;                         \
+        pthread_barrier_wait (targs->barrier);                                      \
+                                                                                    \
+        int block_sum = 0;                                                          \
+        for (b = targs->offset; b < bin_stop; b++) {                                \
+            int sum = 0;                                                            \
+            for (int j = 0; j < targs->num_threads; j++) {                          \
+                int count = targs->tbin[j][b];                                      \
+                targs->tbin[j][b] = sum;                                            \
+                sum += count;                                                       \
+            }                                                                       \
+            targs->global_bin[b] = sum;                                             \
+            block_sum += sum;                                                       \
+            if (sum == num_elements)                                                \
+                job->skip = 1;          /* Every key has this digit */              \
+        }                                                                           \
+        targs->block_sum[targs->tid] = block_sum;                                   \
+        pthread_barrier_wait (targs->barrier2);                                     \
+                                                                                    \
+        int skip = job->skip;                                                       \
+        if (!skip) {                                                                \
+            int idx = 0;                                                            \
+            for (int j = 0; j < targs->tid; j++)                                    \
+                idx += targs->block_sum[j];                                         \
+            for (b = targs->offset; b < bin_stop; b++) {                            \
+                targs->bin_offset[b] = idx;                                         \
+                idx += targs->global_bin[b];                                        \
+            }                                                                       \
+        }                                                                           \
+        pthread_barrier_wait (targs->barrier3);                                     \
+        if (skip) {                                                                 \
+            if (targs->tid == 0)                                                    \
+                job->skip = 0;                                                      \
+            continue;                                                               \
+        }                                                                           \
+                                                                                    \
+        for (b = 0; b < RADIX_BINS; b++)                                            \
+            cursor[b] += targs->bin_offset[b];                                      \
+                                                                                    \
+        if (wc != NULL) {                                                           \
+            /* A key goes to the slot of its destination's offset within the        \
+             * line, so a staged line maps onto one aligned line of dst. A whole    \
+             * line is streamed past the cache; a partial one, at either end of     \
+             * a bin, is copied, as its line is shared with a neighbour. */         \
+            memset (wc_fill, 0, RADIX_BINS * sizeof (int));                         \
+            for (i = mystart; i < mystop; i++) {                                    \
+                key_t key = src[i];                                                 \
+                int d = (key >> shift) & (RADIX_BINS - 1);                          \
+                key_t *line = wc + d * wc_keys;                                     \
+                int slot = (int) (((uintptr_t) (dst + cursor[d]) / sizeof (key_t)) & (wc_keys - 1));\
+                line[slot] = key;                                                   \
+                cursor[d]++;                                                        \
+                if (++wc_fill[d] == wc_keys)                                        \
+                    stream_line (dst + cursor[d] - wc_keys, line);                  \
+                else if (slot == wc_keys - 1)                                       \
+                    memcpy (dst + cursor[d] - wc_fill[d], line + wc_keys - wc_fill[d], wc_fill[d] * sizeof (key_t));\
+                else                                                                \
+                    continue;                                                       \
+                wc_fill[d] = 0;                                                     \
+            }                                                                       \
+            for (b = 0; b < RADIX_BINS; b++)                                        \
+                if (wc_fill[b] > 0) {                                               \
+                    key_t *start = dst + cursor[b] - wc_fill[b];                    \
+                    int slot = (int) (((uintptr_t) start / sizeof (key_t)) & (wc_keys - 1));\
+                    memcpy (start, wc + b * wc_keys + slot, wc_fill[b] * sizeof (key_t));\
+                }                                                                   \
+            _mm_sfence ();                                                          \
+        }                                                                           \
+        else {                                                                      \
+            for (i = mystart; i < mystop; i++) {                                    \
+                key_t key = src[i];                                                 \
+                dst[cursor[(key >> shift) & (RADIX_BINS - 1)]++] = key;             \
+            }                                                                       \
+        }                                                                           \
+        pthread_barrier_wait (targs->barrier);                                      \
+                                                                                    \
+        key_t *swap = src;                                                          \
+        src = dst;                                                                  \
+        dst = swap;                                                                 \
+    }                                                                               \
+                                                                                    \
+    /* An odd number of scatters leaves the result in the buffer */                 \
+    if (src != (key_t *) job->keys)                                                 \
+        memcpy ((key_t *) job->keys + mystart, src + mystart,                       \
+                (mystop - mystart) * sizeof (key_t));                               \
+}
+
+DEFINE_RADIX_WORKER (thread_radix_sort_u32, uint32_t)
+DEFINE_RADIX_WORKER (thread_radix_sort_u64, uint64_t)
+
+/* Entry point for a radix job on a pool worker. */
+void
+thread_radix_sort (ARGS_FOR_THREAD *targs)
+{
+    /* The write-combining lines are allocated on first use from the worker
+     * itself, like the histogram rows, and kept for later sorts. Without them
+     * the scatter writes each key directly. */
+    if (targs->wc_buffer == NULL) {
+        void *wc = NULL;
+        if (posix_memalign (&wc, CACHE_LINE_SIZE, RADIX_BINS * CACHE_LINE_SIZE) == 0) {
+            targs->wc_fill = (int *) malloc (RADIX_BINS * sizeof (int));
+            if (targs->wc_fill == NULL)
+                free (wc);
+            else
+                targs->wc_buffer = wc;
+        }
+    }
+
+    if (targs->radix->key_bytes == sizeof (uint32_t))
+        thread_radix_sort_u32 (targs);
+    else
+        thread_radix_sort_u64 (targs);
+}
+
+/* Fill kernels. Each kernel writes count copies of value starting at
+ * sorted_array. With streaming set, the aligned body of long runs is written
+ * with non-temporal stores that bypass the cache; the caller must issue
+ * _mm_sfence () before the output is handed to another thread. */
+
+void
+fill_run_scalar (int *sorted_array, int value, int count, int streaming)
+{
+    for (int j = 0; j < count; j++)
+        sorted_array[j] = value;
+}
+
+__attribute__ ((target ("avx2")))
+void
+fill_run_avx2 (int *sorted_array, int value, int count, int streaming)
+{
+    int j = 0;
+
+    /* Scalar head up to the first 32-byte boundary */
+    while (j < count && ((uintptr_t) (sorted_array + j) & 31) != 0)
+        sorted_array[j++] = value;
+
+    __m256i v = _mm256_set1_epi32 (value);
+    if (streaming && count - j >= FILL_STREAMING_MIN_RUN) {
+        for (; j + 8 <= count; j += 8)
+            _mm256_stream_si256 ((__m256i *) (sorted_array + j), v);
+    }
+    else {
+        for (; j + 8 <= count; j += 8)
+            _mm256_store_si256 ((__m256i *) (sorted_array + j), v);
+    }
+
+    for (; j < count; j++)
+        sorted_array[j] = value;
+}
+
+__attribute__ ((target ("avx512f")))
+void
+fill_run_avx512 (int *sorted_array, int value, int count, int streaming)
+{
+    int j = 0;
+
+    /* Scalar head up to the first cache-line boundary */
+    while (j < count && ((uintptr_t) (sorted_array + j) & 63) != 0)
+        sorted_array[j++] = value;
+
+    __m512i v = _mm512_set1_epi32 (value);
+    if (streaming && count - j >= FILL_STREAMING_MIN_RUN) {
+        for (; j + 16 <= count; j += 16)
+            _mm512_stream_si512 ((void *) (sorted_array + j), v);
+    }
+    else {
+        for (; j + 16 <= count; j += 16)
+            _mm512_store_si512 ((void *) (sorted_array + j), v);
+    }
+
+    /* Masked store for the tail */
+    if (j < count)
+        _mm512_mask_storeu_epi32 ((void *) (sorted_array + j), (__mmask16) ((1u << (count - j)) - 1), v);
+}
+
+/* Pick the widest fill kernel the CPU supports. */
+FILL_KERNEL
+select_fill_kernel (void)
+{
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f"))
+        return fill_run_avx512;
+    if (__builtin_cpu_supports ("avx2"))
+        return fill_run_avx2;
+    return fill_run_scalar;
+}
+
+/* Size of the last-level cache in bytes; outputs larger than this are streamed. */
+long
+last_level_cache_size (void)
+{
+    long size = sysconf (_SC_LEVEL3_CACHE_SIZE);
+    if (size <= 0)
+        size = sysconf (_SC_LEVEL2_CACHE_SIZE);
+    if (size <= 0)
+        size = 8L * 1024 * 1024;
+    return size;
+}
+
+/* Histogram kernels. Each kernel adds the counts of the num_elements keys in
+ * input_array to bin[0 .. num_bins - 1], where bin 0 holds min_value; the
+ * caller clears bin. scratch must hold histogram_scratch_rows () padded rows
+ * of num_bins ints, and may be NULL when that is 0. A kernel may leave part
+ * of the counts in scratch, which is cleared along with bin and added to it
+ * by histogram_fold () after the last call, so that a caller counting tile by
+ * tile pays for clearing and folding the rows once. */
+
+/* Plain one-bin-at-a-time loop. Runs of repeated keys serialize on the
+ * store-to-load forwarding of the same counter. */
+void
+histogram_scalar (const int *input_array, int num_elements, int *bin, int num_bins, int min_value, int *scratch)
+{
+    for (int i = 0; i < num_elements; i++)
+        bin[input_array[i] - min_value]++;
+}
+
+/* Shared histogram: bin is a shard that other workers add to at the same 
+ * time. Relaxed order is enough, as the barrier before the reduction orders 
+ * the adds against the reads. */
+void
+histogram_atomic (const int *input_array, int num_elements, int *bin, int num_bins, int min_value, int *scratch)
+{
+    for (int i = 0; i < num_elements; i++)
+        __atomic_fetch_add (&bin[input_array[i] - min_value], 1, __ATOMIC_RELAXED);
+}
+
+/* Spread consecutive keys over NUM_SUB_HISTOGRAMS independent rows, bin and
+ * the scratch rows, so that neighbouring equal keys update different
+ * counters. The rows are left for histogram_fold (). */
+void
+histogram_sub_histograms (const int *input_array, int num_elements, int *bin, int num_bins, int min_value, int *scratch)
+{
+    int i, s;
+    int stride = padded_row_length (num_bins);
+    int *sub[NUM_SUB_HISTOGRAMS];
+
+    sub[0] = bin;
+    for (s = 1; s < NUM_SUB_HISTOGRAMS; s++)
+        sub[s] = scratch + (s - 1) * stride;
+
+    for (i = 0; i + NUM_SUB_HISTOGRAMS <= num_elements; i += NUM_SUB_HISTOGRAMS)
+        for (s = 0; s < NUM_SUB_HISTOGRAMS; s++)
+            sub[s][input_array[i + s] - min_value]++;
+    for (; i < num_elements; i++)
+        sub[0][input_array[i] - min_value]++;
+}
+
+/* Add the scratch_rows padded rows of counts a kernel left in scratch to bin. */
+void
+histogram_fold (int *bin, int num_bins, const int *scratch, int scratch_rows)
+{
+    int stride = padded_row_length (num_bins);
+    for (int s = 0; s < scratch_rows; s++)
+        for (int i = 0; i < num_bins; i++)
+            bin[i] += scratch[s * stride + i];
+}
+
+/* AVX-512 conflict detection: gather 16 counters, add one plus the number of
+ * earlier lanes holding the same key, and scatter them back. Scatter writes
+ * overlapping lanes in order, so the last duplicate lane, which carries the
+ * full count, wins. */
+__attribute__ ((target ("avx512f,avx512cd")))
+void
+histogram_avx512_conflict (const int *input_array, int num_elements, int *bin, int num_bins, int min_value, int *scratch)
+{
+    int i;
+    const __m512i ones = _mm512_set1_epi32 (1);
+    const __m512i min_key = _mm512_set1_epi32 (min_value);
+    const __m512i m1 = _mm512_set1_epi32 (0x55555555);
+    const __m512i m2 = _mm512_set1_epi32 (0x33333333);
+    const __m512i m4 = _mm512_set1_epi32 (0x0f0f0f0f);
+    const __m512i m8 = _mm512_set1_epi32 (0x0000003f);
+
+    for (i = 0; i + 16 <= num_elements; i += 16) {
+        __m512i keys = _mm512_sub_epi32 (_mm512_loadu_si512 ((const void *) (input_array + i)), min_key);
+        __m512i conflicts = _mm512_conflict_epi32 (keys);
+
+        /* Population count of each lane's conflict mask */
+        __m512i c = _mm512_sub_epi32 (conflicts, _mm512_and_si512 (_mm512_srli_epi32 (conflicts, 1), m1));
+        c = _mm512_add_epi32 (_mm512_and_si512 (c, m2), _mm512_and_si512 (_mm512_srli_epi32 (c, 2), m2));
+        c = _mm512_and_si512 (_mm512_add_epi32 (c, _mm512_srli_epi32 (c, 4)), m4);
+        c = _mm512_add_epi32 (c, _mm512_srli_epi32 (c, 8));
+        c = _mm512_and_si512 (_mm512_add_epi32 (c, _mm512_srli_epi32 (c, 16)), m8);
+
+        __m512i counts = _mm512_i32gather_epi32 (keys, (const void *) bin, 4);
+        counts = _mm512_add_epi32 (counts, _mm512_add_epi32 (c, ones));
+        _mm512_i32scatter_epi32 ((void *) bin, keys, counts, 4);
+    }
+    for (; i < num_elements; i++)
+        bin[input_array[i] - min_value]++;
+}
+
+static HISTOGRAM_KERNEL selected_histogram_kernel = histogram_sub_histograms;
+static pthread_once_t histogram_kernel_once = PTHREAD_ONCE_INIT;
+
+/* Gather/scatter throughput varies a lot between AVX-512 parts, so when the 
+ * conflict kernel is available it is raced once against the sub-histogram 
+ * kernel on a small skewed sample and only kept if it wins. */
+static void
+calibrate_histogram_kernel (void)
+{
+    __builtin_cpu_init ();
+    if (!(__builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512cd")))
+        return;
+
+    int num_bins = CALIBRATION_BINS;
+    int num_elements = 1 << 16;
+    int *sample = (int *) malloc (num_elements * sizeof (int));
+    int *bin = (int *) malloc (num_bins * sizeof (int));
+    int scratch_rows = histogram_scratch_rows (histogram_sub_histograms);
+    size_t scratch_bytes = (size_t) scratch_rows * padded_row_length (num_bins) * sizeof (int);
+    int *scratch = (int *) malloc (scratch_bytes);
+    if (sample == NULL || bin == NULL || scratch == NULL)
+        goto done;
+
+    unsigned int state = 1;
+    for (int i = 0; i < num_elements; i++) {
+        state = state * 1103515245 + 12345;
+        sample[i] = (i & 1) ? 0 : (state >> 16) % num_bins;
+    }
+
+    HISTOGRAM_KERNEL candidates[] = {histogram_sub_histograms, histogram_avx512_conflict};
+    double best[2] = {0, 0};
+    struct timespec start, stop;
+    for (int k = 0; k < 2; k++) {
+        for (int rep = 0; rep < 3; rep++) {
+            memset (bin, 0, num_bins * sizeof (int));
+            memset (scratch, 0, scratch_bytes);
+            clock_gettime (CLOCK_MONOTONIC, &start);
+            candidates[k] (sample, num_elements, bin, num_bins, 0, scratch);
+            histogram_fold (bin, num_bins, scratch, histogram_scratch_rows (candidates[k]));
+            clock_gettime (CLOCK_MONOTONIC, &stop);
+            double t = elapsed_seconds (&start, &stop);
+            if (rep == 0 || t < best[k])
+                best[k] = t;
+        }
+    }
+    if (best[1] < best[0])
+        selected_histogram_kernel = histogram_avx512_conflict;
+
+done:
+    free (sample);
+    free (bin);
+    free (scratch);
+}
+
+/* Size of the cache private to a core in bytes. */
+static long
+private_cache_size (void)
+{
+    long size = sysconf (_SC_LEVEL2_CACHE_SIZE);
+    if (size <= 0)
+        size = sysconf (_SC_LEVEL1_DCACHE_SIZE);
+    if (size <= 0)
+        size = 256L * 1024;
+    return size;
+}
+
+/* Pick the fastest histogram kernel the CPU supports for num_bins bins. The 
+ * sub-histogram rows only pay off while they stay in the core's private cache; 
+ * past that they add misses and memory, and the plain loop is used instead. */
+HISTOGRAM_KERNEL
+select_histogram_kernel (int num_bins)
+{
+    pthread_once (&histogram_kernel_once, calibrate_histogram_kernel);
+    if (selected_histogram_kernel == histogram_sub_histograms
+        && (long) NUM_SUB_HISTOGRAMS * padded_row_length (num_bins) * sizeof (int) > private_cache_size ())
+        return histogram_scalar;
+    return selected_histogram_kernel;
+}
+
+/* Number of padded scratch rows the kernel needs beside its histogram. */
+int
+histogram_scratch_rows (HISTOGRAM_KERNEL kernel)
+{
+    return (kernel == histogram_sub_histograms) ? NUM_SUB_HISTOGRAMS - 1 : 0;
+}
+
+/* qsort () comparison for the comparison-sort path */
+int
+compare_ints (const void *a, const void *b)
+{
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+/* Name of a path returned by adaptive_sort () */
+const char *
+sort_name (int which)
+{
+    return (which >= 0 && which < NUM_SORTS) ? sort_names[which] : "none";
+}
+
+/* Number of CPUs this process may run on */
+int
+detect_num_cpus (void)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity (0, sizeof (allowed), &allowed) == 0)
+        return CPU_COUNT (&allowed);
+    long num_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    return (num_cpus > 0) ? (int) num_cpus : 1;
+}
+
+/* The tuning cache: $COUNTING_SORT_TUNING if set, otherwise TUNING_FILE in $HOME */
+const char *
+tuning_path (char *path, size_t size)
+{
+    const char *override = getenv ("COUNTING_SORT_TUNING");
+    if (override != NULL)
+        return override;
+    const char *home = getenv ("HOME");
+    snprintf (path, size, "%s/%s", (home != NULL) ? home : ".", TUNING_FILE);
+    return path;
+}
+
+/* Read the tuning cache. Fails if the file is missing, incomplete, or was 
+ * calibrated with a different number of CPUs. Returns 1 on success. */
+int
+load_tuning (const char *path, TUNING *tuning)
+{
+    FILE *fp = fopen (path, "r");
+    if (fp == NULL)
+        return 0;
+
+    char name[64];
+    double value;
+    int found = 0, all = (2 << NUM_TUNING_FIELDS) - 1;     /* num_cpus is the extra bit */
+    while (fscanf (fp, "%63s %lf", name, &value) == 2) {
+        if (strcmp (name, "num_cpus") == 0) {
+            tuning->num_cpus = (int) value;
+            found |= 1 << NUM_TUNING_FIELDS;
+        }
+        for (int i = 0; i < NUM_TUNING_FIELDS; i++)
+            if (strcmp (name, tuning_fields[i].name) == 0) {
+                *(double *) ((char *) tuning + tuning_fields[i].offset) = value;
+                found |= 1 << i;
+            }
+    }
+    fclose (fp);
+
+    return found == all && tuning->num_cpus == detect_num_cpus ();
+}
+
+/* Print the tuning constants in the format of the cache file. */
+void
+print_tuning (FILE *out, const TUNING *tuning)
+{
+    fprintf (out, "num_cpus %d\n", tuning->num_cpus);
+    for (int i = 0; i < NUM_TUNING_FIELDS; i++)
+        fprintf (out, "%s %g\n", tuning_fields[i].name,
+                 *(const double *) ((const char *) tuning + tuning_fields[i].offset));
+}
+
+/* Write the tuning cache. Returns 1 on success. */
+int
+save_tuning (const char *path, const TUNING *tuning)
+{
+    FILE *fp = fopen (path, "w");
+    if (fp == NULL)
+        return 0;
+    print_tuning (fp, tuning);
+    return fclose (fp) == 0;
+}
+
+/* Best of a few runs of one sort, in nanoseconds. which selects the path as in
+ * choose_sort (); pool is used by the threaded and radix paths. */
+double
+time_sort (int which, SORTER *pool, int *input_array, int *sorted_array, uint32_t *buffer,
+           int num_elements, int max_value)
+{
+    struct timespec start, stop;
+    double best = 0;
+    for (int rep = 0; rep < CALIBRATION_REPETITIONS; rep++) {
+        if (which == SORT_COMPARISON || which == SORT_RADIX)
+            memcpy (sorted_array, input_array, num_elements * sizeof (int));
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        if (which == SORT_COMPARISON)
+            qsort (sorted_array, num_elements, sizeof (int), compare_ints);
+        else if (which == SORT_SERIAL)
+            compute_gold (input_array, sorted_array, num_elements, 0, max_value);
+        else if (which == SORT_THREADED)
+            sorter_sort (pool, input_array, sorted_array, num_elements);
+        else
+            sorter_radix_sort_u32 (pool, (uint32_t *) sorted_array, buffer, num_elements);
+        clock_gettime (CLOCK_MONOTONIC, &stop);
+        double t = elapsed_seconds (&start, &stop) * 1e9;
+        if (rep == 0 || t < best)
+            best = t;
+    }
+    return best;
+}
+
+/* Measure the cost model of choose_sort () on this machine. Each constant 
+ * comes from timing its path on inputs where that term dominates. Returns 1 
+ * on success. */
+int
+calibrate_tuning (TUNING *tuning)
+{
+    int num_cpus = detect_num_cpus ();
+    int large = CALIBRATION_ELEMENTS;
+    int small = 1024;
+    int narrow_range = CALIBRATION_BINS - 1;
+    int wide_range = (1 << 22) - 1;                         /* Two 11-bit radix passes */
+
+    int *input_array = (int *) malloc (large * sizeof (int));
+    int *sorted_array = (int *) malloc (large * sizeof (int));
+    uint32_t *buffer = (uint32_t *) malloc (large * sizeof (uint32_t));
+    SORTER *counting_pool = NULL;
+    SORTER *radix_pool = NULL;
+    int status = 0;
+    if (input_array == NULL || sorted_array == NULL || buffer == NULL) {
+        perror ("Malloc");
+        goto done;
+    }
+    counting_pool = sorter_create (num_cpus, 0, narrow_range);
+    radix_pool = sorter_create_radix (num_cpus);
+    if (counting_pool == NULL || radix_pool == NULL)
+        goto done;
+    tuning->num_cpus = num_cpus;
+
+    /* Comparison sort: qsort () is close to n log2 n */
+    if (!generate_input (input_array, small, 0, narrow_range, DIST_UNIFORM, 0, 1, 1))
+        goto done;
+    tuning->compare_ns = time_sort (SORT_COMPARISON, NULL, input_array, sorted_array, NULL, small, narrow_range)
+                         / (small * log2 (small));
+
+    /* Serial counting sort: many keys over few bins, then few keys over many bins */
+    if (!generate_input (input_array, large, 0, narrow_range, DIST_UNIFORM, 0, 1, num_cpus))
+        goto done;
+    double t_elements = time_sort (SORT_SERIAL, NULL, input_array, sorted_array, NULL, large, narrow_range);
+    tuning->serial_element_ns = t_elements / large;
+    if (!generate_input (input_array, small, 0, wide_range, DIST_UNIFORM, 0, 1, 1))
+        goto done;
+    double t_bins = time_sort (SORT_SERIAL, NULL, input_array, sorted_array, NULL, small, wide_range);
+    tuning->serial_bin_ns = fmax (t_bins - small * tuning->serial_element_ns, 0) / (wide_range + 1);
+
+    /* Threaded counting sort: a job of one key per worker is all dispatch */
+    if (!generate_input (input_array, large, 0, narrow_range, DIST_UNIFORM, 0, 1, num_cpus))
+        goto done;
+    tuning->dispatch_ns = time_sort (SORT_THREADED, counting_pool, input_array, sorted_array, NULL, num_cpus, narrow_range);
+    double t_threaded = time_sort (SORT_THREADED, counting_pool, input_array, sorted_array, NULL, large, narrow_range);
+    tuning->threaded_element_ns = fmax (t_threaded - tuning->dispatch_ns, 0) / large;
+
+    /* Radix sort of keys that need two digit passes */
+    if (!generate_input (input_array, large, 0, wide_range, DIST_UNIFORM, 0, 1, num_cpus))
+        goto done;
+    double t_radix = time_sort (SORT_RADIX, radix_pool, input_array, sorted_array, buffer, large, wide_range);
+    tuning->radix_element_ns = fmax (t_radix - tuning->dispatch_ns, 0) / (2.0 * large);
+    status = 1;
+
+done:
+    sorter_destroy (counting_pool);
+    sorter_destroy (radix_pool);
+    free (input_array);
+    free (sorted_array);
+    free (buffer);
+    return status;
+}
+
+/* Predict the cost of each path from the tuning constants and return the 
+ * cheapest. The threaded path needs more than one CPU; the radix path only 
+ * pays off once there are more bins than one digit covers. */
+int
+choose_sort (const TUNING *tuning, int num_elements, long num_bins)
+{
+    double n = (num_elements > 1) ? num_elements : 1;
+    double cost[NUM_SORTS];
+    int radix_passes = 0;
+    for (long digits = num_bins - 1; digits > 0; digits >>= RADIX_BITS)
+        radix_passes++;
+
+    cost[SORT_COMPARISON] = tuning->compare_ns * n * log2 (n + 1);
+    cost[SORT_SERIAL] = tuning->serial_element_ns * n + tuning->serial_bin_ns * num_bins;
+    cost[SORT_THREADED] = (tuning->num_cpus > 1)
+                          ? tuning->dispatch_ns + tuning->threaded_element_ns * n + tuning->serial_bin_ns * num_bins
+                          : INFINITY;
+    cost[SORT_RADIX] = (num_bins > RADIX_BINS)
+                       ? tuning->dispatch_ns + tuning->radix_element_ns * n * radix_passes
+                       : INFINITY;
+
+    int best = SORT_COMPARISON;
+    for (int which = 1; which < NUM_SORTS; which++)
+        if (cost[which] < cost[best])
+            best = which;
+    return best;
+}
+
+/* Create an adaptive sorter for keys in [min_value, max_value]. The tuning 
+ * comes from the cache, or from a calibration run that is then saved. 
+ * Returns NULL on failure. */
+ADAPTIVE_SORTER *
+adaptive_create (int min_value, int max_value)
+{
+    char buffer[PATH_MAX];
+    ADAPTIVE_SORTER *adaptive = (ADAPTIVE_SORTER *) calloc (1, sizeof (ADAPTIVE_SORTER));
+    if (adaptive == NULL) {
+        perror ("Malloc");
+        return NULL;
+    }
+
+    const char *path = tuning_path (buffer, sizeof (buffer));
+    if (!load_tuning (path, &adaptive->tuning)) {
+        if (!calibrate_tuning (&adaptive->tuning)) {
+            free (adaptive);
+            return NULL;
+        }
+        if (!save_tuning (path, &adaptive->tuning))
+            perror (path);
+    }
+    adaptive->min_value = min_value;
+    adaptive->max_value = max_value;
+    adaptive->pool = NULL;
+    adaptive->radix_pool = NULL;
+    adaptive->radix_buffer = NULL;
+    adaptive->radix_capacity = 0;
+    return adaptive;
+}
+
+/* Sort num_elements keys by the path choose_sort () predicts to be fastest. 
+ * The worker pools are created on the first sort that needs them and kept. 
+ * Returns the path taken, or -1 on failure. */
+int
+adaptive_sort (ADAPTIVE_SORTER *adaptive, int *input_array, int *sorted_array, int num_elements)
+{
+    int i;
+    long num_bins = (long) adaptive->max_value - adaptive->min_value + 1;
+    int which = choose_sort (&adaptive->tuning, num_elements, num_bins);
+
+    /* The radix pool has its own RADIX_BINS-wide rows rather than rows for the whole key range */
+    if (which == SORT_THREADED && adaptive->pool == NULL) {
+        adaptive->pool = sorter_create (adaptive->tuning.num_cpus, adaptive->min_value, adaptive->max_value);
+        if (adaptive->pool == NULL)
+            return -1;
+    }
+    if (which == SORT_RADIX && adaptive->radix_pool == NULL) {
+        adaptive->radix_pool = sorter_create_radix (adaptive->tuning.num_cpus);
+        if (adaptive->radix_pool == NULL)
+            return -1;
+    }
+
+    switch (which) {
+        case SORT_COMPARISON:
+            memcpy (sorted_array, input_array, num_elements * sizeof (int));
+            qsort (sorted_array, num_elements, sizeof (int), compare_ints);
+            break;
+
+        case SORT_SERIAL:
+            if (compute_gold (input_array, sorted_array, num_elements, adaptive->min_value, adaptive->max_value) == 0)
+                return -1;
+            break;
+
+        case SORT_THREADED:
+            sorter_sort (adaptive->pool, input_array, sorted_array, num_elements);
+            break;
+
+        case SORT_RADIX:
+            /* Sort the offsets from min_value as unsigned keys, which keeps their order */
+            if (adaptive->radix_capacity < num_elements) {
+                free (adaptive->radix_buffer);
+                adaptive->radix_buffer = (uint32_t *) malloc (num_elements * sizeof (uint32_t));
+                adaptive->radix_capacity = (adaptive->radix_buffer != NULL) ? num_elements : 0;
+                if (adaptive->radix_buffer == NULL) {
+                    perror ("Malloc");
+                    return -1;
+                }
+            }
+            for (i = 0; i < num_elements; i++)
+                sorted_array[i] = (int) ((uint32_t) input_array[i] - (uint32_t) adaptive->min_value);
+            if (sorter_radix_sort_u32 (adaptive->radix_pool, (uint32_t *) sorted_array, adaptive->radix_buffer, num_elements) == 0)
+                return -1;
+            for (i = 0; i < num_elements; i++)
+                sorted_array[i] = (int) ((uint32_t) sorted_array[i] + (uint32_t) adaptive->min_value);
+            break;
+    }
+
+    return which;
+}
+
+void
+adaptive_destroy (ADAPTIVE_SORTER *adaptive)
+{
+    if (adaptive == NULL)
+        return;
+    sorter_destroy (adaptive->pool);
+    sorter_destroy (adaptive->radix_pool);
+    free (adaptive->radix_buffer);
+    free (adaptive);
+}
+
+/* Return the time between two CLOCK_MONOTONIC readings in seconds. */
+double
+elapsed_seconds (struct timespec *start, struct timespec *stop)
+{
+    return (stop->tv_sec - start->tv_sec) + (stop->tv_nsec - start->tv_nsec) / 1e9;
+}
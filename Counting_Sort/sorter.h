@@ -0,0 +1,337 @@
+/* Counting sort library: a reusable pool of parked worker threads that sorts 
+ * integer keys in a fixed range, plus the serial, radix, run-length, 
+ * incremental and adaptive sorts built on it.
+ *
+ * Build as a static or a shared library:
+ *
+ *     gcc -c sorter.c -std=c99 -Wall -O3 -fPIC -D_GNU_SOURCE
+ *     ar rcs libsorter.a sorter.o
+ *     gcc -shared -o libsorter.so sorter.o -lpthread -lm
+ *
+ * and link with -L. -lsorter -lpthread -lm.
+ *
+ * A sorter's memory can come from the caller: size an arena with 
+ * sorter_arena_bytes (), hand it to sorter_init (), and after sorter_destroy () 
+ * it is the caller's again. Sorting then allocates nothing per call. Two 
+ * optional buffers are the exceptions, allocated once and freed by 
+ * sorter_destroy (): each worker's write-combining lines, RADIX_BINS cache 
+ * lines and as many counters, taken on its first radix sort so that counting 
+ * sorters do not pay for them; and the profile rings of 
+ * sorter_enable_profile (). sorter_init () and the sorter_create functions 
+ * print nothing and report failure in errno.
+ */
+
+#ifndef SORTER_H
+#define SORTER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/* Histogram kernel: adds the counts of input_array, offset by the minimum key, 
+ * into bin and the scratch rows, which histogram_fold () adds into bin */
+typedef void (*HISTOGRAM_KERNEL) (const int *, int, int *, int, int, int *);
+
+/* Fill kernel: writes a run of identical keys into the sorted array */
+typedef void (*FILL_KERNEL) (int *, int, int, int);
+
+/* Input distributions for generate_input () */
+#define DIST_UNIFORM  0
+#define DIST_ZIPF     1                 /* Key min_value + k has weight 1 / (k + 1)^exponent */
+#define DIST_SORTED   2
+#define DIST_REVERSE  3
+#define DIST_EQUAL    4                 /* Every key is min_value */
+
+/* Payload layouts for sorter_sort_pairs () */
+#define PAYLOAD_SOA   0                 /* Payloads in an array parallel to the keys */
+#define PAYLOAD_AOS   1                 /* Records with the int key embedded in each */
+#define PAYLOAD_INDEX 2                 /* No payload; emit the sorting permutation */
+
+/* Paths taken by adaptive_sort () */
+#define SORT_COMPARISON 0               /* qsort (), for tiny inputs */
+#define SORT_SERIAL     1               /* compute_gold () */
+#define SORT_THREADED   2               /* Counting sort on the worker pool */
+#define SORT_RADIX      3               /* Radix sort on the worker pool, for wide key ranges */
+#define NUM_SORTS       4
+
+/* Cost model of this machine used by adaptive_sort (), in nanoseconds. It is 
+ * calibrated once and cached in TUNING_FILE. */
+typedef struct tuning_t {
+    int num_cpus;                       /* CPUs available when calibrated; a change recalibrates */
+    double compare_ns;                  /* qsort (): per element per log2 of the element count */
+    double serial_element_ns;           /* compute_gold (): per element */
+    double serial_bin_ns;               /* compute_gold (): per bin */
+    double dispatch_ns;                 /* Worker pool: releasing and completing one job */
+    double threaded_element_ns;         /* Worker pool counting sort: per element */
+    double radix_element_ns;            /* Worker pool radix sort: per element per digit pass */
+} TUNING;
+
+/* Describes the data that travels with the keys in a stable sort. */
+typedef struct payload_t {
+    int layout;                         /* PAYLOAD_SOA, PAYLOAD_AOS or PAYLOAD_INDEX */
+    size_t size;                        /* Bytes per payload (SoA) or per record (AoS) */
+    size_t key_offset;                  /* AoS: byte offset of the int key within a record */
+    const void *src;                    /* SoA payloads or AoS records; unused for PAYLOAD_INDEX */
+    void *dst;                          /* Sorted payloads or records, or an int permutation */
+} PAYLOAD;
+
+/* A radix sort job shared by all workers */
+typedef struct radix_job_t {
+    int key_bytes;                      /* 4 or 8 */
+    void *keys;                         /* Keys to sort; holds the result */
+    void *buffer;                       /* Ping-pong buffer of the same size */
+    int skip;                           /* Set when every key has the same digit in this pass */
+} RADIX_JOB;
+
+/* Points at which thread_sort () timestamps a profiled sort, in order. The 
+ * phases between them are count, wait, reduce, wait, prefix, wait and fill. */
+#define MARK_START    0
+#define MARK_COUNT    1                 /* Local histogram built */
+#define MARK_BARRIER  2                 /* Released from barrier */
+#define MARK_REDUCE   3                 /* Bin range reduced */
+#define MARK_BARRIER2 4                 /* Released from barrier2 */
+#define MARK_PREFIX   5                 /* Prefix sums of the bin range written */
+#define MARK_BARRIER3 6                 /* Released from barrier3 */
+#define MARK_FILL     7                 /* Output range written */
+#define NUM_MARKS     8
+
+/* Hardware counters read at every mark when profiling with counters */
+#define COUNTER_CYCLES     0
+#define COUNTER_LLC_MISSES 1
+#define NUM_COUNTERS       2
+
+/* Sorts kept in each worker's profile ring */
+#define PROFILE_SAMPLES 64
+
+typedef struct phase_sample_t {
+    uint64_t ns[NUM_MARKS];             /* CLOCK_MONOTONIC at each mark */
+    uint64_t counter[NUM_COUNTERS][NUM_MARKS];
+} PHASE_SAMPLE;
+
+/* Profile ring of one worker. Only the worker writes it, and only while a job
+ * runs; the submitter reads it between jobs, after done_barrier, so no lock 
+ * is needed. */
+typedef struct phase_profile_t {
+    PHASE_SAMPLE sample[PROFILE_SAMPLES];
+    long num_sorts;                     /* Sorts recorded; the ring holds the last PROFILE_SAMPLES */
+    int counter_fd[NUM_COUNTERS];       /* perf_event_open () descriptors, or -1 */
+} PHASE_PROFILE;
+
+typedef struct args_for_thread_t {
+    int tid;                            /* The thread ID */
+    int num_threads;                    /* Number of worker threads */
+    int offset;                         /* Starting offset for thread within the vectors */
+    int chunk_size;                     /* Chunk size */
+    int num_elements;                   /* shared number of elements */
+    int *input_array;
+    int range;
+    int min_value;                      /* Smallest key; bin 0 counts this value */
+    int *global_bin;
+    int **tbin;                         /* Per-thread histogram rows, one per worker */
+    int *scratch;                       /* Sub-histogram rows for the histogram kernel, or NULL */
+    int *sorted;
+    PAYLOAD *payload;                   /* Non-NULL for a stable key-value sort */
+    RADIX_JOB *radix;                   /* Non-NULL for a radix sort */
+    int histogram_only;                 /* Stop once global_bin is reduced */
+    int prefix_only;                    /* Stop once bin_offset is written */
+    void *wc_buffer;                    /* Radix scatter: one cache line of staged keys per bin */
+    int *wc_fill;                       /* Radix scatter: number of keys staged in each line since its last write */
+    PHASE_PROFILE *profile;             /* Non-NULL while phase profiling is enabled */
+    pid_t kernel_tid;                   /* Kernel thread ID, for attaching counters */
+    int *idx;
+    pthread_barrier_t *barrier;         /* Wait here until all local histograms are built */
+    pthread_barrier_t *barrier2;        /* Wait here until the global histogram is reduced */
+    pthread_barrier_t *barrier3;        /* Wait here until the prefix sums are complete */
+    int *bin_offset;                    /* Exclusive prefix sum of global_bin, num_bins + 1 entries */
+    int *block_sum;                     /* Per-thread totals of the reduced bin ranges */
+    struct sorter_t *sorter;            /* Pool that owns this worker */
+
+} ARGS_FOR_THREAD;
+
+/* Sorter that picks its algorithm per call from the machine's tuning */
+typedef struct adaptive_sorter_t {
+    TUNING tuning;
+    int min_value;
+    int max_value;
+    struct sorter_t *pool;              /* Counting pool, created on the first threaded sort */
+    struct sorter_t *radix_pool;        /* Radix pool, created on the first radix sort */
+    uint32_t *radix_buffer;             /* Ping-pong buffer for the radix path */
+    int radix_capacity;                 /* Elements radix_buffer can hold */
+} ADAPTIVE_SORTER;
+
+/* Run-length view of a sorted array: key min_value + i occurs count[i] times, 
+ * starting at position offset[i]. Built by sorter_sort_runs (). */
+typedef struct run_view_t {
+    int min_value;
+    int num_bins;
+    int num_elements;
+    const int *count;                   /* The sorter's global_bin */
+    const int *offset;                  /* The sorter's bin_offset, num_bins + 1 entries */
+    FILL_KERNEL fill_kernel;            /* Used to materialize runs */
+} RUN_VIEW;
+
+/* Forward iterator over a RUN_VIEW, by run or by key */
+typedef struct run_cursor_t {
+    const RUN_VIEW *view;
+    int bin;                            /* Current run, -1 before the first */
+    int remaining;                      /* Keys of the current run not yet returned by run_cursor_next () */
+} RUN_CURSOR;
+
+/* Changes accepted by incremental_apply () */
+#define DELTA_INSERT 0                  /* Add one occurrence of key */
+#define DELTA_DELETE 1                  /* Remove one occurrence of key */
+#define DELTA_UPDATE 2                  /* Change one occurrence of key to new_key */
+
+typedef struct delta_t {
+    int op;                             /* One of the DELTA_ values */
+    int key;
+    int new_key;                        /* DELTA_UPDATE only */
+} DELTA;
+
+/* Sorted view of a changing multiset of keys. The counts are updated per 
+ * delta; the prefix sums and the output are brought up to date lazily, and 
+ * only over the bins that changed, by incremental_refresh (). */
+typedef struct incremental_sorter_t {
+    struct sorter_t *pool;              /* Sorts the keys given to incremental_load () */
+    int min_value;
+    int max_value;
+    int num_bins;
+    int *bin;                           /* Live count of each key */
+    int *bin_offset;                    /* Output offset of each bin as of the last refresh, plus the total */
+    int *sorted;                        /* Sorted keys as of the last refresh */
+    int num_elements;                   /* Live number of keys */
+    int capacity;                       /* Keys sorted can hold */
+    int dirty_low;                      /* Lowest and highest bins changed since the last */
+    int dirty_high;                     /* refresh; none when dirty_low > dirty_high */
+    FILL_KERNEL fill_kernel;
+} INCREMENTAL_SORTER;
+
+/* Private histogram rows are padded to a whole number of cache lines and 
+ * placed on their own pages, so rows never share a line and each can be 
+ * first-touched on its worker's NUMA node. */
+#define CACHE_LINE_SIZE 64
+
+/* Reusable sorter context. The worker threads are created once and stay 
+ * parked on start_barrier between sorts; each call to sorter_sort () 
+ * publishes a job in args_for_thread and releases them. */
+typedef struct sorter_t {
+    int num_threads;                    /* Number of worker threads in the pool */
+    int min_value;                      /* Smallest key value */
+    int range;                          /* Range of key values */
+    int num_bins;                       /* Number of histogram bins */
+    pthread_t *tid;                     /* Worker thread IDs */
+    ARGS_FOR_THREAD *args_for_thread;   /* Per-worker arguments, reused across sorts */
+    int *global_bin;                    /* Global histogram */
+    int *bin_offset;                    /* Starting output index of each bin, plus the total */
+    int *block_sum;                     /* Number of elements in each thread's bin range */
+    int **tbin;                         /* Per-thread histograms, each row owned by its worker */
+    int tbin_stride;                    /* Padded row length in ints */
+    int threads_per_shard;              /* 0 for private rows, else workers sharing each atomic shard */
+    int num_shards;
+    int **shard;                        /* Shared atomic histograms, each owned by its group's first worker */
+    int tile_elements;                  /* Keys per counting tile in the current sort */
+    /* Next unclaimed counting tile, advanced atomically by every worker. It 
+     * has a cache line to itself, so that the claims do not keep evicting the 
+     * read-only fields around it from the workers' caches. */
+    _Alignas (CACHE_LINE_SIZE) int tile_cursor;
+    char tile_cursor_padding[CACHE_LINE_SIZE - sizeof (int)];
+    HISTOGRAM_KERNEL histogram_kernel;  /* Counting kernel picked by CPU feature and number of bins */
+    int scratch_rows;                   /* Sub-histogram rows after each private row, 0 if the kernel needs none */
+    FILL_KERNEL fill_kernel;            /* Output fill kernel picked by CPU feature */
+    long llc_bytes;                     /* Outputs larger than this use streaming stores */
+    pthread_barrier_t barrier;
+    pthread_barrier_t barrier2;
+    pthread_barrier_t barrier3;
+    pthread_barrier_t start_barrier;    /* Workers plus submitter: release a job */
+    pthread_barrier_t done_barrier;     /* Workers plus submitter: job complete */
+    pthread_mutex_t launch;             /* Held by sorter_init () while it creates the workers */
+    int shutdown;                       /* Set by sorter_destroy () to retire the workers */
+    void *owned_arena;                  /* Memory from sorter_create_sharded (), freed by sorter_destroy (); NULL for a caller's arena */
+} SORTER;
+
+/* Default number of consecutive, and with PIN_WORKERS neighbouring, workers 
+ * that share one atomic histogram shard in a sharded sorter */
+#define THREADS_PER_SHARD 8
+
+/* Number of interleaved sub-histograms used by histogram_sub_histograms () */
+#define NUM_SUB_HISTOGRAMS 4
+
+/* Radix sort digit width. 11-bit digits sort 32-bit keys in three passes and 
+ * 64-bit keys in six; 8 trades more passes for a smaller, L1-resident histogram. */
+#define RADIX_BITS 11
+#define RADIX_BINS (1 << RADIX_BITS)
+
+/* Default Zipf exponent for -d zipf */
+#define ZIPF_EXPONENT 1.0
+
+/* Serial sorts */
+int compute_gold (int *, int *, int, int, int);
+int counting_sort_u8 (const uint8_t *, uint8_t *, size_t, uint8_t, uint8_t);
+int counting_sort_u16 (const uint16_t *, uint16_t *, size_t, uint16_t, uint16_t);
+int counting_sort_u32 (const uint32_t *, uint32_t *, size_t, uint32_t, uint32_t);
+
+/* Worker pool */
+size_t sorter_arena_bytes (int, int, int, int);
+SORTER *sorter_init (void *, size_t, int, int, int, int);
+SORTER *sorter_create (int, int, int);
+SORTER *sorter_create_sharded (int, int, int, int);
+SORTER *sorter_create_radix (int);
+void sorter_destroy (SORTER *);
+int compute_using_pthreads (int *, int *, int, int, int, int);
+void sorter_sort (SORTER *, int *, int *, int);
+int sorter_sort_pairs (SORTER *, const int *, int *, int, PAYLOAD *);
+void sorter_histogram (SORTER *, const int *, int);
+int sorter_radix_sort_u32 (SORTER *, uint32_t *, uint32_t *, int);
+int sorter_radix_sort_u64 (SORTER *, uint64_t *, uint64_t *, int);
+int sorter_enable_profile (SORTER *, int);
+void sorter_print_profile (SORTER *, FILE *);
+
+/* Run-length output */
+void sorter_sort_runs (SORTER *, const int *, int, RUN_VIEW *);
+int run_view_key (const RUN_VIEW *, int);
+void run_view_materialize (const RUN_VIEW *, int, int, int *);
+void run_cursor_init (RUN_CURSOR *, const RUN_VIEW *);
+int run_cursor_next_run (RUN_CURSOR *, int *, int *);
+int run_cursor_next (RUN_CURSOR *, int *);
+
+/* Incremental sorts */
+INCREMENTAL_SORTER *incremental_create (int, int, int);
+int incremental_load (INCREMENTAL_SORTER *, int *, int);
+int incremental_apply (INCREMENTAL_SORTER *, const DELTA *, int);
+const int *incremental_refresh (INCREMENTAL_SORTER *);
+void incremental_destroy (INCREMENTAL_SORTER *);
+
+/* Adaptive front-end */
+const char *sort_name (int);
+int detect_num_cpus (void);
+const char *tuning_path (char *, size_t);
+int load_tuning (const char *, TUNING *);
+int save_tuning (const char *, const TUNING *);
+void print_tuning (FILE *, const TUNING *);
+int calibrate_tuning (TUNING *);
+int choose_sort (const TUNING *, int, long);
+ADAPTIVE_SORTER *adaptive_create (int, int);
+int adaptive_sort (ADAPTIVE_SORTER *, int *, int *, int);
+void adaptive_destroy (ADAPTIVE_SORTER *);
+
+/* Kernels */
+void histogram_scalar (const int *, int, int *, int, int, int *);
+void histogram_atomic (const int *, int, int *, int, int, int *);
+void histogram_sub_histograms (const int *, int, int *, int, int, int *);
+void histogram_avx512_conflict (const int *, int, int *, int, int, int *);
+void histogram_fold (int *, int, const int *, int);
+HISTOGRAM_KERNEL select_histogram_kernel (int);
+int histogram_scratch_rows (HISTOGRAM_KERNEL);
+FILL_KERNEL select_fill_kernel (void);
+long last_level_cache_size (void);
+int padded_row_length (int);
+
+/* Input generation and timing */
+int parse_distribution (const char *, double *);
+int generate_input (int *, int, int, int, int, double, uint64_t, int);
+double elapsed_seconds (struct timespec *, struct timespec *);
+
+#endif /* SORTER_H */
@@ -6,7 +6,7 @@
  * Date created: February 20, 2020
  * Date modified: March 6, 2020
  *
- * Compile as follows: gcc -o intercept_syscalls intercept_syscalls.c -std=c99 -Wall 
+ * Compile as follows: gcc -o intercept_syscalls intercept_syscalls.c tracee_memory.c -std=c99 -Wall 
  * Execute as follows: ./intercept_syscalls ./program-name 
  * Ex: ./intercept_syscalls ./hello_world
  * 
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 
 /* POSIX includes */
 #include <unistd.h>
@@ -31,8 +32,10 @@
 #include <sys/ptrace.h>
 #include <linux/ptrace.h>
 
+#include "tracee_memory.h"
+
 /* Function prototypes */
-unsigned char *read_buffer_contents (pid_t, unsigned int, long);
+unsigned char *read_buffer_contents (pid_t, unsigned int, long, TRACEE_BUFFER *);
 void modify_buffer_contents (pid_t, unsigned char *, unsigned int, long);
 void print_buffer_contents (unsigned char *, unsigned int);
 
@@ -79,6 +82,9 @@ main (int argc, char **argv)
      */
     ptrace (PTRACE_SETOPTIONS, pid, 0, PTRACE_O_EXITKILL);
 
+    /* Copies of the tracee's write() buffers, reused from one call to the next */
+    TRACEE_BUFFER scratch = {NULL, 0};
+
     /* Intercept and examine the system calls made by the tracee */
     while (1) {
         /* Wait for the tracee to begin the next system call */
@@ -128,15 +134,14 @@ main (int argc, char **argv)
                  * write out. */
                 fprintf (stderr, "Tracee intends to write %d bytes located at %p\n", (unsigned int) regs.rdx, (void *) regs.rsi);
 
-                buffer = read_buffer_contents (pid, (unsigned int) regs.rdx, regs.rsi); /* Read tracee buffer */
+                buffer = read_buffer_contents (pid, (unsigned int) regs.rdx, regs.rsi, &scratch); /* Read tracee buffer */
+                if (buffer == NULL)
+                    break;
                 print_buffer_contents (buffer, (unsigned int) regs.rdx); /* Print contents of tracee buffer */
 
                 /* FIXME: Convert the contents of buffer to upper-case and write the modified contents 
                  * to the tracee's address space. */
                 modify_buffer_contents (pid, buffer, (unsigned int) regs.rdx, regs.rsi);
-
-                free ((void *) buffer);
-                buffer = NULL;
                 break;
 
             default:
@@ -151,6 +156,7 @@ main (int argc, char **argv)
         if (ptrace (PTRACE_GETREGS, pid, 0, &regs) == -1) {
             if (errno == ESRCH) {   /* System call was exit() or similar */ 
                 fprintf (stderr, "\n");
+                tracee_buffer_free (&scratch);
                 exit (regs.rdi);
             }                            
             
@@ -172,68 +178,38 @@ main (int argc, char **argv)
     exit (EXIT_SUCCESS);
 }
 
-/* Read contents of the buffer for the write() system call located at specified address */
+/* Read contents of the buffer for the write() system call located at specified address. 
+ * The whole buffer is copied with a single process_vm_readv() rather than one 
+ * PTRACE_PEEKDATA per word, into scratch, which is reused across calls. Returns 
+ * the copy, valid until the next call, or NULL if the buffer cannot be read.
+ */
 unsigned char * 
-read_buffer_contents (pid_t pid, unsigned int count, long address)
+read_buffer_contents (pid_t pid, unsigned int count, long address, TRACEE_BUFFER *scratch)
 {
-    unsigned char *c, *buffer;
-    long data;
-    unsigned int i, j, idx, num_words, lop_off;
-        
-    /* Allocate space to store the contents of the buffer */
-    buffer = (unsigned char *) malloc (sizeof (unsigned char) * count);
-
-    num_words = count/sizeof (long);
-    lop_off = count - num_words * sizeof (long);
-    idx = 0;
-    
-    /* Peek into the tracee's address space, each time returning a word (eight bytes) of data. 
-     * Typecast the word into characters and store in our buffer.
-     */
-    for (i = 0; i < num_words; i++) {
-        data = ptrace (PTRACE_PEEKDATA, pid, (void *) (address + i * sizeof (long)), 0);
-        c = (unsigned char *) &data;
-        for (j = 0; j < sizeof (long); j++)
-            buffer[idx++] = c[j];
-    }
-
-    /* If the number of bytes is not a perfect multiple of the word length,
-     * read and store the rest of the characters in our buffer.
-     */
-    if (lop_off > 0) {
-        data = ptrace (PTRACE_PEEKDATA, pid, (void *) (address + i * sizeof (long)), 0);
-        c = (unsigned char *) &data;
-        for (j = 0; j < lop_off; j++)
-            buffer[idx++] = c[j];
-    }
+    unsigned char *buffer = tracee_read_buffer (pid, (unsigned long) address, count, scratch);
+    if (buffer == NULL)
+        fprintf (stderr, "Cannot read %u bytes at %p\n", count, (void *) address);
 
     return buffer;
 }
 
-/* FIXME: Complete this function to modify contents of provided buffer to upper case, and 
- * write the modified contents to the address space of tracee, starting at the specified address. 
+/* Convert the count bytes of the provided buffer to upper case, in place, and write them 
+ * back to the address space of the tracee, starting at the specified address. The buffer 
+ * is the scratch copy made by read_buffer_contents(), so nothing is allocated here. The 
+ * write-back is a single process_vm_writev(); pages it cannot write, such as read-only 
+ * string literals, take one PTRACE_POKEDATA per word, reading back only the partial words 
+ * at the two ends.
  */
 void 
 modify_buffer_contents (pid_t pid, unsigned char *buffer, unsigned int count, long address)
 {
-    //printf("\n\nFunction modify_buffer_contents called. Address %ld has been rewritten. New buffer in all caps: ", address);
-    // convert data in buffer to uppercase
-    unsigned char *upper_buffer;
-
-        
-    /* Allocate space to store the contents of the buffer with uppercase letter */
-    upper_buffer = (unsigned char *) malloc (sizeof (unsigned char) * count);
-    for (int n = 0; n < strlen(buffer); n++)
-            {
-                upper_buffer[n] = toupper(buffer[n]);
-            }
-    buffer=upper_buffer;
-    
-    //write words to address
+    unsigned int i;
+    for (i = 0; i < count; i++)
+        buffer[i] = toupper (buffer[i]);
+
+    if (tracee_write (pid, (unsigned long) address, buffer, count) != (ssize_t) count)
+        fprintf (stderr, "Cannot write %u bytes at %p\n", count, (void *) address);
 
-    for (int n = 0; n < strlen(buffer); n++){
-        ptrace (PTRACE_POKEDATA, pid, (void *) (address + n * sizeof (unsigned char)), buffer[n]);
-    }
     return;
 }
 
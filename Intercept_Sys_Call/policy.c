@@ -0,0 +1,863 @@
+/* Sandbox policy engine; see policy.h for the policy file format.
+ *
+ * Compile together with the sandbox:
+ * gcc -o sandbox sandbox.c policy.c tracee_memory.c -std=c99 -Wall
+ */
+
+#define _GNU_SOURCE                     /* readlink (), realpath (), statx () */
+
+/* Includes from the C standard library */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+/* POSIX includes */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <sys/stat.h>
+
+/* Linux includes */
+#include <syscall.h>
+#include <linux/close_range.h>
+#include <linux/openat2.h>
+
+#include "tracee_memory.h"
+#include "policy.h"
+
+/* Longest line of a policy file */
+#define POLICY_LINE_MAX (TRACEE_PATH_MAX + 64)
+
+/* Symbolic links followed in resolving one path, as the kernel allows */
+#define MAX_SYMLINK_HOPS 40
+
+/* Where the system calls that can be checked keep their arguments */
+typedef struct syscall_args_t {
+    const char *name;
+    long number;
+    int path_arg;                       /* Argument holding the path */
+    int dirfd_arg;                      /* Directory a relative path starts from, or -1 for the cwd */
+    int flags_arg;                      /* open () flags, or -1 if the call always writes */
+    int flags_in_how;                   /* Whether flags_arg points to a struct open_how instead */
+    int returns_fd;                     /* Whether the result is a new file descriptor */
+    int follow;                         /* Whether a symbolic link as last component is followed */
+} SYSCALL_ARGS;
+
+static const SYSCALL_ARGS syscall_args[] = {
+    { "open",     SYS_open,     0, -1,  1, 0, 1, 1 },
+    { "openat",   SYS_openat,   1,  0,  2, 0, 1, 1 },
+    { "openat2",  SYS_openat2,  1,  0,  2, 1, 1, 1 },
+    { "creat",    SYS_creat,    0, -1, -1, 0, 1, 1 },
+    { "truncate", SYS_truncate, 0, -1, -1, 0, 0, 1 },
+    { "mkdir",    SYS_mkdir,    0, -1, -1, 0, 0, 0 },
+    { "mkdirat",  SYS_mkdirat,  1,  0, -1, 0, 0, 0 },
+    { "rmdir",    SYS_rmdir,    0, -1, -1, 0, 0, 0 },
+    { "unlink",   SYS_unlink,   0, -1, -1, 0, 0, 0 },
+    { "unlinkat", SYS_unlinkat, 1,  0, -1, 0, 0, 0 },
+};
+#define NUM_SYSCALL_ARGS ((int) (sizeof (syscall_args) / sizeof (syscall_args[0])))
+
+/* System calls stopped on to keep a tracee's TRACEE_STATE up to date: those
+ * that change its working directory, or rename or remove a directory, 
+ * whenever some call is checked, and those that close or duplicate 
+ * descriptors, if descriptors are tracked */
+static const long cwd_syscalls[] = { SYS_chdir, SYS_fchdir };
+static const long rename_syscalls[] = { SYS_rename, SYS_renameat, SYS_renameat2, SYS_rmdir, SYS_unlinkat };
+static const long fd_syscalls[] = { SYS_close, SYS_close_range, SYS_dup, SYS_dup2, SYS_dup3 };
+#define NUM_CWD_SYSCALLS ((int) (sizeof (cwd_syscalls) / sizeof (cwd_syscalls[0])))
+#define NUM_RENAME_SYSCALLS ((int) (sizeof (rename_syscalls) / sizeof (rename_syscalls[0])))
+#define NUM_FD_SYSCALLS ((int) (sizeof (fd_syscalls) / sizeof (fd_syscalls[0])))
+
+const char *default_policy =
+    "# Reads anywhere, writes only under /tmp\n"
+    "syscall open check\n"
+    "syscall openat check\n"
+    "syscall openat2 check\n"
+    "syscall creat check\n"
+    "path read allow /\n"
+    "path write allow /tmp\n";
+
+/* Collapse repeated slashes, "." and ".." in the absolute path in, without
+ * following symbolic links. Returns the length written to out, or -1 if it
+ * does not fit in size bytes. */
+static int
+normalize_path (const char *in, char *out, size_t size)
+{
+    size_t len = 0;
+    const char *p = in;
+
+    while (*p != '\0') {
+        while (*p == '/')
+            p++;
+        const char *start = p;
+        while (*p != '\0' && *p != '/')
+            p++;
+        size_t n = p - start;
+
+        if (n == 0 || (n == 1 && start[0] == '.'))
+            continue;
+        if (n == 2 && start[0] == '.' && start[1] == '.') {
+            /* Drop the last component; ".." of the root is the root */
+            while (len > 0 && out[len - 1] != '/')
+                len--;
+            if (len > 0)
+                len--;
+            continue;
+        }
+        if (len + 1 + n + 1 > size)
+            return -1;
+        out[len++] = '/';
+        memcpy (out + len, start, n);
+        len += n;
+    }
+
+    if (len + 2 > size)
+        return -1;
+    if (len == 0)
+        out[len++] = '/';
+    out[len] = '\0';
+    return len;
+}
+
+/* Read the tracee's directory dirfd, or its working directory for AT_FDCWD,
+ * from /proc into base, which holds TRACEE_PATH_MAX bytes. Returns 0 on
+ * success and -1 on error. */
+static int
+read_base_directory (pid_t pid, long dirfd, char *base)
+{
+    char link[64];
+    if (dirfd == AT_FDCWD)
+        snprintf (link, sizeof (link), "/proc/%d/cwd", (int) pid);
+    else
+        snprintf (link, sizeof (link), "/proc/%d/fd/%d", (int) pid, (int) dirfd);
+
+    ssize_t n = readlink (link, base, TRACEE_PATH_MAX);
+    if (n <= 0 || n >= TRACEE_PATH_MAX)
+        return -1;
+    base[n] = '\0';
+    return 0;
+}
+
+/* Join path to the directory base unless it is absolute, into joined, which
+ * holds size bytes. Returns 0 on success and -1 if it does not fit. */
+static int
+join_path (const char *base, const char *path, char *joined, size_t size)
+{
+    int n = (path[0] == '/') ? snprintf (joined, size, "%s", path)
+                             : snprintf (joined, size, "%s/%s", base, path);
+    return (n >= 0 && (size_t) n < size) ? 0 : -1;
+}
+
+/* Resolve the absolute directory dir, following symbolic links, into out,
+ * which holds PATH_MAX bytes. If part of it does not exist, the longest part
+ * that does is resolved and the rest is appended as it is, normalized: the
+ * system call fails there anyway. Returns 0 on success and -1 on error. */
+static int
+resolve_directory (const char *dir, char *out)
+{
+    char prefix[2 * TRACEE_PATH_MAX], joined[3 * TRACEE_PATH_MAX], resolved[PATH_MAX];
+
+    if (realpath (dir, out) != NULL)
+        return 0;
+    if (snprintf (prefix, sizeof (prefix), "%s", dir) >= (int) sizeof (prefix))
+        return -1;
+
+    /* Cut components off the end until what is left exists; the root does */
+    char *slash;
+    while ((slash = strrchr (prefix, '/')) != NULL) {
+        *slash = '\0';
+        if (realpath ((prefix[0] != '\0') ? prefix : "/", resolved) != NULL) {
+            snprintf (joined, sizeof (joined), "%s/%s", resolved, dir + (slash - prefix) + 1);
+            return (normalize_path (joined, out, PATH_MAX) == -1) ? -1 : 0;
+        }
+    }
+    return -1;
+}
+
+/* Resolve the absolute path the way the kernel would, into out, which holds
+ * size bytes: symbolic links are followed in every directory, and in the last
+ * component too if follow, so that a link cannot lead a write outside the
+ * prefixes it is allowed under. Paths are resolved in the sandbox's own view
+ * of the file system, which the tracee shares. Returns the length written to
+ * out, or -1 on error, including a loop of links. */
+static int
+resolve_path (const char *path, int follow, char *out, size_t size)
+{
+    char current[2 * TRACEE_PATH_MAX], dir[PATH_MAX], target[TRACEE_PATH_MAX];
+    char joined[PATH_MAX + 2 * TRACEE_PATH_MAX];
+    struct stat st;
+
+    if (snprintf (current, sizeof (current), "%s", path) >= (int) sizeof (current))
+        return -1;
+
+    for (int hops = 0; hops <= MAX_SYMLINK_HOPS; hops++) {
+        /* Split off the last component, ignoring trailing slashes */
+        size_t length = strlen (current);
+        while (length > 1 && current[length - 1] == '/')
+            current[--length] = '\0';
+        char *slash = strrchr (current, '/');
+        char *name = slash + 1;
+        *slash = '\0';
+        if (resolve_directory ((current[0] != '\0') ? current : "/", dir) == -1)
+            return -1;
+
+        snprintf (joined, sizeof (joined), "%s/%s", dir, name);
+        if (!follow || name[0] == '\0' || strcmp (name, ".") == 0 || strcmp (name, "..") == 0
+            || lstat (joined, &st) == -1 || !S_ISLNK (st.st_mode))
+            return normalize_path (joined, out, size);
+
+        /* Follow the link from the directory it is in */
+        ssize_t n = readlink (joined, target, sizeof (target) - 1);
+        if (n <= 0)
+            return -1;
+        target[n] = '\0';
+        if (target[0] == '/')
+            snprintf (current, sizeof (current), "%s", target);
+        else if (snprintf (current, sizeof (current), "%s/%s", dir, target) >= (int) sizeof (current))
+            return -1;
+    }
+
+    return -1;
+}
+
+/* Turn a path named by the tracee into an absolute, resolved path. A
+ * relative path starts from the tracee's directory dirfd, or from its working
+ * directory for AT_FDCWD, as found in /proc. Returns the length written to
+ * out, or -1 on error. */
+int
+canonicalize_path (pid_t pid, long dirfd, const char *path, char *out, size_t size)
+{
+    char base[TRACEE_PATH_MAX], joined[2 * TRACEE_PATH_MAX];
+
+    if (path[0] != '/' && read_base_directory (pid, dirfd, base) == -1)
+        return -1;
+    if (join_path (base, path, joined, sizeof (joined)) == -1)
+        return -1;
+
+    return resolve_path (joined, 1, out, size);
+}
+
+/* Add a node to the trie. Returns its index, or -1 if the trie cannot grow. */
+static int
+new_node (POLICY *policy)
+{
+    if (policy->num_nodes == policy->capacity) {
+        int capacity = (policy->capacity > 0) ? 2 * policy->capacity : 64;
+        POLICY_NODE *node = (POLICY_NODE *) realloc (policy->node, capacity * sizeof (POLICY_NODE));
+        if (node == NULL) {
+            perror ("realloc");
+            return -1;
+        }
+        policy->node = node;
+        policy->capacity = capacity;
+    }
+
+    POLICY_NODE *node = &policy->node[policy->num_nodes];
+    memset (node->child, 0, sizeof (node->child));
+    node->action[ACCESS_READ] = node->action[ACCESS_WRITE] = -1;
+    return policy->num_nodes++;
+}
+
+/* Record a path rule for the normalized prefix. Returns 0 on success. */
+static int
+add_path_rule (POLICY *policy, const char *prefix, int access, int action)
+{
+    int node = 0;
+
+    /* The root rule lives at the empty prefix, so that it covers every path */
+    if (strcmp (prefix, "/") != 0) {
+        for (const unsigned char *p = (const unsigned char *) prefix; *p != '\0'; p++) {
+            if (policy->node[node].child[*p] == 0) {
+                int child = new_node (policy);
+                if (child == -1)
+                    return -1;
+                policy->node[node].child[*p] = child;
+            }
+            node = policy->node[node].child[*p];
+        }
+    }
+
+    if (access != ACCESS_WRITE) {
+        policy->node[node].action[ACCESS_READ] = action;
+        policy->num_rules[ACCESS_READ] += (node != 0);
+    }
+    if (access != ACCESS_READ) {
+        policy->node[node].action[ACCESS_WRITE] = action;
+        policy->num_rules[ACCESS_WRITE] += (node != 0);
+    }
+    return 0;
+}
+
+/* Decide an access to the normalized path from the longest prefix rule that
+ * covers it. A prefix covers a path only up to a component boundary, so
+ * /tmp covers /tmp/a but not /tmpfoo. */
+static int
+lookup_path (const POLICY *policy, const char *path, int access)
+{
+    int node = 0;
+    int decision = policy->node[0].action[access];
+
+    for (const unsigned char *p = (const unsigned char *) path; *p != '\0'; p++) {
+        node = policy->node[node].child[*p];
+        if (node == 0)
+            break;
+        if (policy->node[node].action[access] >= 0 && (p[1] == '/' || p[1] == '\0'))
+            decision = policy->node[node].action[access];
+    }
+
+    return (decision >= 0) ? decision : POLICY_DENY;
+}
+
+/* Compile the policy text, naming it source in error messages. Returns 0 on
+ * success and -1 on error, leaving nothing to free. */
+int
+policy_compile (POLICY *policy, const char *text, const char *source)
+{
+    int i, line_number = 0;
+
+    memset (policy->action, POLICY_ALLOW, sizeof (policy->action));
+    memset (policy->args, -1, sizeof (policy->args));
+    policy->track_fds = 0;
+    policy->num_rules[ACCESS_READ] = policy->num_rules[ACCESS_WRITE] = 0;
+    policy->node = NULL;
+    policy->num_nodes = 0;
+    policy->capacity = 0;
+    if (new_node (policy) == -1)
+        return -1;
+
+    while (*text != '\0') {
+        char line[POLICY_LINE_MAX];
+        size_t length = strcspn (text, "\n");
+        line_number++;
+        if (length >= sizeof (line)) {
+            fprintf (stderr, "%s:%d: line too long\n", source, line_number);
+            goto error;
+        }
+        memcpy (line, text, length);
+        line[length] = '\0';
+        text += length;
+        if (*text == '\n')
+            text++;
+
+        char kind[16], what[16], action[16], prefix[TRACEE_PATH_MAX];
+        int fields = sscanf (line, "%15s %15s %15s %4095s", kind, what, action, prefix);
+        if (fields <= 0 || kind[0] == '#')
+            continue;
+
+        if (strcmp (kind, "syscall") == 0 && fields == 3) {
+            /* System call by name or by number */
+            long number = -1;
+            int args = -1;
+            for (i = 0; i < NUM_SYSCALL_ARGS; i++)
+                if (strcmp (what, syscall_args[i].name) == 0) {
+                    number = syscall_args[i].number;
+                    args = i;
+                }
+            if (number == -1) {
+                char *end;
+                number = strtol (what, &end, 10);
+                if (*end != '\0' || end == what)
+                    number = -1;
+                for (i = 0; i < NUM_SYSCALL_ARGS; i++)
+                    if (number == syscall_args[i].number)
+                        args = i;
+            }
+            if (number < 0 || number >= POLICY_MAX_SYSCALL) {
+                fprintf (stderr, "%s:%d: unknown system call %s\n", source, line_number, what);
+                goto error;
+            }
+
+            if (strcmp (action, "allow") == 0)
+                policy->action[number] = POLICY_ALLOW;
+            else if (strcmp (action, "deny") == 0)
+                policy->action[number] = POLICY_DENY;
+            else if (strcmp (action, "check") == 0 && args >= 0)
+                policy->action[number] = POLICY_CHECK;
+            else {
+                fprintf (stderr, "%s:%d: cannot %s system call %s\n", source, line_number, action, what);
+                goto error;
+            }
+            policy->args[number] = args;
+        }
+        else if (strcmp (kind, "path") == 0 && fields == 4) {
+            int access = -1, decision = -1;
+            char normalized[TRACEE_PATH_MAX];
+            if (strcmp (what, "read") == 0)
+                access = ACCESS_READ;
+            else if (strcmp (what, "write") == 0)
+                access = ACCESS_WRITE;
+            else if (strcmp (what, "any") == 0)
+                access = NUM_ACCESS;
+            if (strcmp (action, "allow") == 0)
+                decision = POLICY_ALLOW;
+            else if (strcmp (action, "deny") == 0)
+                decision = POLICY_DENY;
+            if (access == -1 || decision == -1 || prefix[0] != '/'
+                || normalize_path (prefix, normalized, sizeof (normalized)) == -1) {
+                fprintf (stderr, "%s:%d: invalid path rule\n", source, line_number);
+                goto error;
+            }
+            if (add_path_rule (policy, normalized, access, decision) == -1)
+                goto error;
+        }
+        else if (strcmp (kind, "track") == 0 && fields == 2 && strcmp (what, "descriptors") == 0) {
+            policy->track_fds = 1;
+        }
+        else {
+            fprintf (stderr, "%s:%d: invalid rule\n", source, line_number);
+            goto error;
+        }
+    }
+
+    /* The working directory, decisions and descriptors are only needed to
+     * check calls, and io_uring would open files past the checks */
+    for (i = 0; i < POLICY_MAX_SYSCALL; i++)
+        if (policy->action[i] == POLICY_CHECK)
+            break;
+    if (i == POLICY_MAX_SYSCALL)
+        policy->track_fds = 0;
+    else {
+        policy->action[SYS_io_uring_setup] = POLICY_DENY;
+        for (i = 0; i < NUM_CWD_SYSCALLS; i++)
+            if (policy->action[cwd_syscalls[i]] == POLICY_ALLOW)
+                policy->action[cwd_syscalls[i]] = POLICY_TRACK;
+        for (i = 0; i < NUM_RENAME_SYSCALLS; i++)
+            if (policy->action[rename_syscalls[i]] == POLICY_ALLOW)
+                policy->action[rename_syscalls[i]] = POLICY_TRACK;
+        for (i = 0; i < NUM_FD_SYSCALLS && policy->track_fds; i++)
+            if (policy->action[fd_syscalls[i]] == POLICY_ALLOW)
+                policy->action[fd_syscalls[i]] = POLICY_TRACK;
+    }
+
+    return 0;
+
+error:
+    policy_free (policy);
+    return -1;
+}
+
+/* Read and compile the policy file at path. Returns 0 on success and -1 on
+ * error. */
+int
+policy_load (POLICY *policy, const char *path)
+{
+    FILE *fp = fopen (path, "r");
+    if (fp == NULL) {
+        perror (path);
+        return -1;
+    }
+
+    size_t length = 0, capacity = 4096;
+    char *text = (char *) malloc (capacity);
+    while (text != NULL) {
+        length += fread (text + length, 1, capacity - length - 1, fp);
+        if (length < capacity - 1)
+            break;
+        capacity *= 2;
+        char *grown = (char *) realloc (text, capacity);
+        if (grown == NULL)
+            free (text);
+        text = grown;
+    }
+    int failed = ferror (fp);
+    fclose (fp);
+    if (text == NULL || failed) {
+        fprintf (stderr, "Cannot read %s\n", path);
+        free (text);
+        return -1;
+    }
+    text[length] = '\0';
+
+    int status = policy_compile (policy, text, path);
+    free (text);
+    return status;
+}
+
+/* Free the compiled policy */
+void
+policy_free (POLICY *policy)
+{
+    free ((void *) policy->node);
+    policy->node = NULL;
+    policy->num_nodes = 0;
+    policy->capacity = 0;
+}
+
+/* Argument i of the system call whose registers are regs */
+static long
+syscall_argument (const struct user_regs_struct *regs, int i)
+{
+    switch (i) {
+        case 0: return regs->rdi;
+        case 1: return regs->rsi;
+        case 2: return regs->rdx;
+        case 3: return regs->r10;
+        case 4: return regs->r8;
+        default: return regs->r9;
+    }
+}
+
+/* Start remembering what is known of the tracee pid, adding it to list.
+ * Returns its state, or NULL on error. */
+TRACEE_STATE *
+tracee_state_add (TRACEE_STATE **list, pid_t pid)
+{
+    TRACEE_STATE *tracee = (TRACEE_STATE *) calloc (1, sizeof (TRACEE_STATE));
+    if (tracee == NULL) {
+        perror ("calloc");
+        return NULL;
+    }
+
+    tracee->pid = pid;
+    tracee->next = *list;
+    tracee->list = list;
+    *list = tracee;
+    return tracee;
+}
+
+/* State of the tracee pid in list, or NULL if it is not there */
+TRACEE_STATE *
+tracee_state_find (TRACEE_STATE *list, pid_t pid)
+{
+    while (list != NULL && list->pid != pid)
+        list = list->next;
+    return list;
+}
+
+/* Forget every decision the tracee made */
+static void
+flush_decisions (TRACEE_STATE *tracee)
+{
+    if (tracee->num_decisions == 0)
+        return;
+    for (int i = 0; i < DECISION_CACHE_SIZE; i++) {
+        free ((void *) tracee->decision[i].name);
+        free ((void *) tracee->decision[i].path);
+        tracee->decision[i].name = tracee->decision[i].path = NULL;
+    }
+    tracee->num_decisions = 0;
+}
+
+/* Slot of the tracee's decision cache for an access to name in the
+ * directory of the given mount and inode: the one holding it, or the free
+ * one it goes in. The cache must exist and have a free slot. */
+static DECISION *
+find_decision (TRACEE_STATE *tracee, unsigned long long mount, unsigned long long inode,
+               const char *name, int access)
+{
+    /* FNV-1a over the name, mixed with the rest of the key */
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *) name; *p != '\0'; p++)
+        hash = (hash ^ *p) * 16777619u;
+    hash = (hash ^ (unsigned int) (inode ^ (inode >> 32) ^ (mount << 8) ^ access)) * 16777619u;
+
+    DECISION *slot = &tracee->decision[hash % DECISION_CACHE_SIZE];
+    while (slot->name != NULL
+           && !(slot->inode == inode && slot->mount == mount && slot->access == access
+                && strcmp (slot->name, name) == 0))
+        slot = (slot == &tracee->decision[DECISION_CACHE_SIZE - 1]) ? tracee->decision : slot + 1;
+    return slot;
+}
+
+/* Remember the decision on an access to name, in the directory of the given
+ * mount and inode, to be action on the resolved path. The cache is made on
+ * first use, and starts over once it fills up; a decision that cannot be
+ * remembered is simply made again next time. */
+static void
+remember_decision (TRACEE_STATE *tracee, unsigned long long mount, unsigned long long inode,
+                   const char *name, int access, const char *path, int action)
+{
+    if (tracee->decision == NULL) {
+        tracee->decision = (DECISION *) calloc (DECISION_CACHE_SIZE, sizeof (DECISION));
+        if (tracee->decision == NULL)
+            return;
+    }
+    if (tracee->num_decisions >= DECISION_CACHE_SIZE / 4 * 3)
+        flush_decisions (tracee);
+
+    DECISION *decision = find_decision (tracee, mount, inode, name, access);
+    decision->name = strdup (name);
+    decision->path = strdup (path);
+    if (decision->name == NULL || decision->path == NULL) {
+        free ((void *) decision->name);
+        free ((void *) decision->path);
+        decision->name = decision->path = NULL;
+        return;
+    }
+    decision->mount = mount;
+    decision->inode = inode;
+    decision->access = access;
+    decision->action = action;
+    tracee->num_decisions++;
+}
+
+/* Forget descriptor fd */
+static void
+forget_fd (TRACEE_STATE *tracee, long fd)
+{
+    if (fd >= 0 && fd < tracee->num_fds) {
+        free ((void *) tracee->fd[fd].path);
+        tracee->fd[fd].path = NULL;
+    }
+}
+
+/* Remember that descriptor fd refers to path. A copy of path is kept; a NULL
+ * path forgets fd. */
+static void
+remember_fd (TRACEE_STATE *tracee, long fd, const char *path)
+{
+    if (fd < 0 || fd > INT_MAX / 2)
+        return;
+    if (fd >= tracee->num_fds) {
+        if (path == NULL)
+            return;
+        int num_fds = (tracee->num_fds > 0) ? tracee->num_fds : 64;
+        while (num_fds <= fd)
+            num_fds *= 2;
+        FD_ENTRY *entry = (FD_ENTRY *) realloc (tracee->fd, num_fds * sizeof (FD_ENTRY));
+        if (entry == NULL)
+            return;                     /* Not remembered, so read from /proc when needed */
+        for (int i = tracee->num_fds; i < num_fds; i++)
+            entry[i].path = NULL;
+        tracee->fd = entry;
+        tracee->num_fds = num_fds;
+    }
+
+    char *copy = (path != NULL) ? strdup (path) : NULL;
+    forget_fd (tracee, fd);
+    tracee->fd[fd].path = copy;
+}
+
+/* The tracee replaced its program: descriptors opened close-on-exec are gone,
+ * so forget them all rather than keep some that no longer exist */
+void
+tracee_state_exec (TRACEE_STATE *tracee)
+{
+    for (int fd = 0; fd < tracee->num_fds; fd++)
+        forget_fd (tracee, fd);
+}
+
+/* Stop remembering the tracee, which leaves its list and is freed */
+void
+tracee_state_remove (TRACEE_STATE *tracee)
+{
+    TRACEE_STATE **link = tracee->list;
+    while (*link != tracee)
+        link = &(*link)->next;
+    *link = tracee->next;
+
+    tracee_state_exec (tracee);
+    flush_decisions (tracee);
+    free ((void *) tracee->decision);
+    free ((void *) tracee->fd);
+    free ((void *) tracee->cwd);
+    free ((void *) tracee);
+}
+
+/* Directory that a relative path given to the tracee's call starts from:
+ * dirfd, or the working directory for AT_FDCWD, into base, which holds
+ * TRACEE_PATH_MAX bytes. The working directory is read from /proc only the
+ * first time, and remembered until a call changes it. A descriptor is
+ * remembered only if the policy tracks descriptors, and is read again for a
+ * write: it may have been closed and reused in a way that was not seen, and
+ * a remembered path that turns out stale is replaced.
+ * Returns the directory, or NULL on error. */
+static const char *
+base_directory (const POLICY *policy, TRACEE_STATE *tracee, long dirfd, int access, char *base)
+{
+    if (dirfd == AT_FDCWD) {
+        if (tracee->cwd == NULL && read_base_directory (tracee->pid, dirfd, base) == 0)
+            tracee->cwd = strdup (base);
+        return tracee->cwd;
+    }
+
+    int known = (dirfd >= 0 && dirfd < tracee->num_fds && tracee->fd[dirfd].path != NULL);
+    if (known && access == ACCESS_READ)
+        return tracee->fd[dirfd].path;
+
+    if (read_base_directory (tracee->pid, dirfd, base) == -1)
+        return NULL;
+    if (policy->track_fds && !(known && strcmp (tracee->fd[dirfd].path, base) == 0))
+        remember_fd (tracee, dirfd, base);
+    return base;
+}
+
+/* Whether the system call whose registers are regs may rename or remove a
+ * directory, which a decision was taken in or through */
+static int
+moves_directory (const struct user_regs_struct *regs)
+{
+    long number = regs->orig_rax;
+    return number == SYS_rename || number == SYS_renameat || number == SYS_renameat2
+           || number == SYS_rmdir || (number == SYS_unlinkat && (regs->rdx & AT_REMOVEDIR));
+}
+
+/* Update the state of the tracees on entry to a POLICY_TRACK call. Threads
+ * may share a working directory or descriptors, and which do is not known,
+ * so what the call changes is forgotten by every tracee; it is read again
+ * from /proc when next needed. Returns POLICY_TRACK if that is all there is
+ * to do, or POLICY_ALLOW if policy_record () needs the result: the result of
+ * a dup (), and the end of a rename or removal, after which decisions that
+ * other tracees made while it ran are stale too. */
+static int
+track_entry (TRACEE_STATE *tracee, const struct user_regs_struct *regs)
+{
+    long number = regs->orig_rax;
+    long fd;
+    TRACEE_STATE *other;
+
+    /* Decisions are dropped at the exit of a rename or removal */
+    if (moves_directory (regs))
+        return POLICY_ALLOW;
+    if (number == SYS_unlinkat)
+        return POLICY_TRACK;
+
+    for (other = *tracee->list; other != NULL; other = other->next) {
+        if (number == SYS_close) {
+            forget_fd (other, (int) regs->rdi);
+        }
+        else if (number == SYS_close_range) {
+            if (!(regs->rdx & CLOSE_RANGE_CLOEXEC))
+                for (fd = (unsigned int) regs->rdi; fd <= (unsigned int) regs->rsi && fd < other->num_fds; fd++)
+                    forget_fd (other, fd);
+        }
+        else if (number == SYS_chdir || number == SYS_fchdir) {
+            free ((void *) other->cwd);
+            other->cwd = NULL;
+        }
+        else {
+            /* dup2 () and dup3 () close newfd first, unless it is oldfd */
+            if (number != SYS_dup && (int) regs->rdi != (int) regs->rsi)
+                forget_fd (other, (int) regs->rsi);
+        }
+    }
+
+    return (number == SYS_dup || number == SYS_dup2 || number == SYS_dup3) ? POLICY_ALLOW : POLICY_TRACK;
+}
+
+/* Decide the system call the tracee is stopped at. For a POLICY_CHECK call
+ * the path is read from the tracee, resolved into path, which holds size
+ * bytes, and looked up in the trie, or taken from the tracee's decision cache
+ * along with its decision; a path that cannot be read or resolved is
+ * denied. If the policy has no rule but the one for "/" for the access asked
+ * for, that rule decides, and path is left as named. For other calls path is
+ * left empty. Returns POLICY_ALLOW or POLICY_DENY, or POLICY_TRACK for a call
+ * that needs no more attention. */
+int
+policy_check (const POLICY *policy, TRACEE_STATE *tracee, const struct user_regs_struct *regs, char *path, size_t size)
+{
+    long number = regs->orig_rax;
+    tracee->entry = *regs;
+    path[0] = '\0';
+    if (number < 0 || number >= POLICY_MAX_SYSCALL)
+        return POLICY_ALLOW;
+    if (policy->action[number] == POLICY_TRACK)
+        return track_entry (tracee, regs);
+    if (policy->action[number] != POLICY_CHECK)
+        return policy->action[number];
+
+    const SYSCALL_ARGS *args = &syscall_args[(int) policy->args[number]];
+    char raw[TRACEE_PATH_MAX];
+    if (tracee_read_string (tracee->pid, syscall_argument (regs, args->path_arg), raw, sizeof (raw)) == -1)
+        return POLICY_DENY;
+    snprintf (path, size, "%s", raw);
+
+    int access = ACCESS_WRITE, follow = args->follow;
+    if (args->flags_arg >= 0) {
+        long flags = syscall_argument (regs, args->flags_arg);
+        if (args->flags_in_how) {
+            /* openat2 () passes its flags in a struct open_how. RESOLVE_IN_ROOT 
+             * makes even an absolute path start from dirfd, which the path 
+             * rules cannot tell apart, so it is denied. */
+            struct open_how how;
+            if (tracee_read (tracee->pid, flags, &how, sizeof (how)) != (ssize_t) sizeof (how)
+                || (how.resolve & RESOLVE_IN_ROOT))
+                return POLICY_DENY;
+            flags = how.flags;
+        }
+        if ((flags & O_ACCMODE) == O_RDONLY && !(flags & (O_CREAT | O_TRUNC)))
+            access = ACCESS_READ;
+        if (flags & O_NOFOLLOW)
+            follow = 0;
+    }
+
+    /* Where every path is decided alike, there is nothing to resolve */
+    if (policy->num_rules[access] == 0)
+        return lookup_path (policy, "/", access);
+
+    char joined[2 * TRACEE_PATH_MAX], directory[TRACEE_PATH_MAX];
+    const char *base = "";
+    if (raw[0] != '/') {
+        long dirfd = (args->dirfd_arg >= 0) ? (int) syscall_argument (regs, args->dirfd_arg) : AT_FDCWD;
+        base = base_directory (policy, tracee, dirfd, access, directory);
+        if (base == NULL)
+            return POLICY_DENY;
+    }
+    if (join_path (base, raw, joined, sizeof (joined)) == -1)
+        return POLICY_DENY;
+
+    /* Find the decision by the directory the last component is in, unless
+     * that component is a link to follow or does not name an entry of its own */
+    char *slash = strrchr (joined, '/');
+    const char *name = slash + 1;
+    struct statx dir;
+    struct stat st;
+    int cached = (name[0] != '\0' && strcmp (name, ".") != 0 && strcmp (name, "..") != 0);
+    if (cached) {
+        *slash = '\0';
+        cached = (statx (AT_FDCWD, (slash > joined) ? joined : "/", 0, STATX_INO | STATX_MNT_ID, &dir) == 0
+                  && (dir.stx_mask & (STATX_INO | STATX_MNT_ID)) == (STATX_INO | STATX_MNT_ID));
+        *slash = '/';
+    }
+    if (cached && follow && lstat (joined, &st) == 0 && S_ISLNK (st.st_mode))
+        cached = 0;
+    if (cached && tracee->decision != NULL) {
+        DECISION *decision = find_decision (tracee, dir.stx_mnt_id, dir.stx_ino, name, access);
+        if (decision->name != NULL) {
+            snprintf (path, size, "%s", decision->path);
+            return decision->action;
+        }
+    }
+
+    if (resolve_path (joined, follow, path, size) == -1)
+        return POLICY_DENY;
+    int action = lookup_path (policy, path, access);
+    if (cached)
+        remember_decision (tracee, dir.stx_mnt_id, dir.stx_ino, name, access, path, action);
+    return action;
+}
+
+/* Record the result of the call last passed to policy_check () that the
+ * tracee was allowed to make, path being the path it returned. A rename or
+ * removal that went through drops the decisions of every tracee. A checked
+ * call that opens a file leaves its descriptor remembered with its path, and
+ * a duplicated descriptor takes over what is known of the original. */
+void
+policy_record (const POLICY *policy, TRACEE_STATE *tracee, const char *path, long result)
+{
+    const struct user_regs_struct *regs = &tracee->entry;
+    long number = regs->orig_rax;
+    if (result < 0 || number < 0 || number >= POLICY_MAX_SYSCALL)
+        return;
+
+    if (moves_directory (regs)) {
+        for (TRACEE_STATE *other = *tracee->list; other != NULL; other = other->next)
+            flush_decisions (other);
+        return;
+    }
+    if (!policy->track_fds)
+        return;
+
+    if (policy->action[number] == POLICY_CHECK && syscall_args[(int) policy->args[number]].returns_fd)
+        remember_fd (tracee, result, path);
+    else if ((number == SYS_dup || number == SYS_dup2 || number == SYS_dup3) && result != (int) regs->rdi) {
+        long oldfd = (int) regs->rdi;
+        if (oldfd >= 0 && oldfd < tracee->num_fds && tracee->fd[oldfd].path != NULL)
+            remember_fd (tracee, result, tracee->fd[oldfd].path);
+        else
+            forget_fd (tracee, result);
+    }
+}
@@ -0,0 +1,139 @@
+/* Sandbox policy engine.
+ *
+ * A policy file is compiled once, at startup, into a table holding an action
+ * for every system call number and a trie of path prefixes. A policed system
+ * call then costs one table lookup and one walk of the trie over its
+ * resolved path, whatever the number of rules. Paths are resolved as the
+ * kernel would, following symbolic links, so that a link under an allowed
+ * prefix cannot lead elsewhere.
+ *
+ * Policy file format, one rule per line; blank lines and lines starting
+ * with # are ignored:
+ *
+ *     syscall <name or number> allow|deny|check
+ *     path read|write|any allow|deny <absolute path prefix>
+ *     track descriptors
+ *
+ * "check" stops the tracee and decides the call from the path rules; it is
+ * accepted for the system calls that take a path, listed in policy.c. System
+ * calls without a rule are allowed. A path rule covers the prefix and
+ * everything below it, on whole path components, and the longest matching
+ * prefix wins. Paths that no rule covers are denied. Once any call is
+ * checked, io_uring_setup () is denied with EPERM whatever the rules say:
+ * an io_uring opens files without a system call that could be stopped on.
+ *
+ * Where the policy has no rule below "/" for an access, as the default one
+ * for reads, the path is not resolved at all. Other decisions are remembered
+ * per tracee, keyed on the mount and inode of the directory the last
+ * component is in and on that component as named, rather than on the path:
+ * a link changed in a directory above then leads to another key, and a last
+ * component that is a link to follow is never taken from the cache. What is
+ * left to change a decision is a rename or removal of a directory, so every
+ * cache is dropped when a tracee makes one. The tracee's working directory
+ * is remembered too; a policy that checks any call therefore also stops the
+ * tracee on chdir (), fchdir (), rename () and rmdir () and their variants,
+ * which are rare next to opens. Changes made by processes outside the
+ * sandbox are not seen.
+ *
+ * "track descriptors" also remembers the path of each descriptor, so that a
+ * call relative to a directory descriptor does not look it up in /proc. It
+ * is off by default because it stops the tracee on every close () and dup ()
+ * and their variants, which costs more than it saves unless the guest makes
+ * many such calls per directory it opens, as a recursive rm does.
+ *
+ * Compile together with the sandbox:
+ * gcc -o sandbox sandbox.c policy.c tracee_memory.c -std=c99 -Wall
+ */
+
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include "tracee_memory.h"
+
+/* Actions per system call and per path rule */
+#define POLICY_ALLOW 0
+#define POLICY_DENY  1
+#define POLICY_CHECK 2                  /* Stop at the tracer and apply the path rules */
+#define POLICY_TRACK 3                  /* Stop at the tracer to keep TRACEE_STATE up to date */
+
+/* Access requested by a policed system call */
+#define ACCESS_READ  0
+#define ACCESS_WRITE 1                  /* Any write, create, truncate or removal */
+#define NUM_ACCESS   2
+
+/* System call numbers covered by the action table */
+#define POLICY_MAX_SYSCALL 512
+
+/* Path trie node. Each byte of a prefix is one level; node 0, the root, is
+ * the empty prefix, which the rule for "/" is stored at. */
+typedef struct policy_node_t {
+    int child[256];                     /* Node reached by each next byte, or 0 for none */
+    signed char action[NUM_ACCESS];     /* POLICY_ALLOW or POLICY_DENY for a rule ending here, or -1 */
+} POLICY_NODE;
+
+typedef struct policy_t {
+    unsigned char action[POLICY_MAX_SYSCALL];   /* POLICY_ action of each system call */
+    signed char args[POLICY_MAX_SYSCALL];       /* Where a POLICY_CHECK call keeps its path, or -1 */
+    int track_fds;                      /* Whether descriptors are remembered */
+    int num_rules[NUM_ACCESS];          /* Path rules other than the one for "/" */
+    POLICY_NODE *node;                  /* Path trie */
+    int num_nodes;
+    int capacity;                       /* Nodes allocated */
+} POLICY;
+
+/* Open file descriptor of a tracee */
+typedef struct fd_entry_t {
+    char *path;                         /* Path it was opened on, or NULL if not known */
+} FD_ENTRY;
+
+/* Slots in a tracee's decision cache, a power of two */
+#define DECISION_CACHE_SIZE 4096
+
+/* Remembered decision on an access to a name in a directory */
+typedef struct decision_t {
+    char *name;                         /* Last component as named, or NULL for a free slot */
+    unsigned long long mount;           /* Mount id and inode of the directory it is in */
+    unsigned long long inode;
+    int access;                         /* ACCESS_ mode asked for */
+    int action;                         /* POLICY_ALLOW or POLICY_DENY */
+    char *path;                         /* Resolved path it was decided on */
+} DECISION;
+
+/* What the sandbox knows of one tracee, a process or thread. All tracees
+ * are kept in one list, since threads may share their working directory and
+ * descriptors. */
+typedef struct tracee_state_t {
+    pid_t pid;
+    struct tracee_state_t *next;
+    struct tracee_state_t **list;       /* Head of the list this tracee is in */
+    char *cwd;                          /* Working directory, or NULL until next needed */
+    DECISION *decision;                 /* DECISION_CACHE_SIZE slots, or NULL until the first */
+    int num_decisions;                  /* Slots in use */
+    FD_ENTRY *fd;                       /* Indexed by descriptor */
+    int num_fds;
+    struct user_regs_struct entry;      /* Registers at entry of the call in progress */
+    int in_syscall;                     /* Whether it runs to the exit of that call */
+    int attached;                       /* Whether the SIGSTOP it starts with was seen */
+    char path[TRACEE_PATH_MAX];         /* Path of that call, or empty */
+} TRACEE_STATE;
+
+/* Policy used when none is given; reads anywhere, writes only under /tmp */
+extern const char *default_policy;
+
+int policy_compile (POLICY *, const char *, const char *);
+int policy_load (POLICY *, const char *);
+void policy_free (POLICY *);
+int policy_check (const POLICY *, TRACEE_STATE *, const struct user_regs_struct *, char *, size_t);
+void policy_record (const POLICY *, TRACEE_STATE *, const char *, long);
+int canonicalize_path (pid_t, long, const char *, char *, size_t);
+
+TRACEE_STATE *tracee_state_add (TRACEE_STATE **, pid_t);
+TRACEE_STATE *tracee_state_find (TRACEE_STATE *, pid_t);
+void tracee_state_remove (TRACEE_STATE *);
+void tracee_state_exec (TRACEE_STATE *);
+
+#endif /* POLICY_H */
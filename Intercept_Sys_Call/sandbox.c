@@ -1,19 +1,33 @@
 /* 
- * Compile as follows: gcc -o sandbox sandbox.c -std=c99 -Wall 
+ * Compile as follows: gcc -o sandbox sandbox.c policy.c tracee_memory.c -std=c99 -Wall 
  * Execute as follows: 
- * Ex: ./sandbox ./guest_program 
+ * Ex: ./sandbox [-p policy-file] ./guest_program 
  * The tracee program is in the same directory as your sandbox program.
  *
+ * The policy, the default one of policy.c unless a policy file is given, is 
+ * compiled once at startup; see policy.h for its format. The child installs 
+ * a seccomp filter before exec, built from the policy, that hands only the 
+ * system calls to check to the sandbox as PTRACE_EVENT_SECCOMP stops and 
+ * fails the denied ones itself. Every other system call runs without stopping.
+ * Paths are resolved as the kernel would, following symbolic links, before 
+ * they are decided. Children and threads 
+ * of the guest inherit the filter and are traced the same way.
+ *
  */
 
+#define _GNU_SOURCE                     /* __WALL, kill () */
+
 /* Includes from the C standard library */
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <stddef.h>
+#include <signal.h>
 
 /* POSIX includes */
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/user.h>
 #include <sys/wait.h>
@@ -21,36 +35,60 @@
 /* Linux includes */
 #include <syscall.h>
 #include <sys/ptrace.h>
+#include <sys/prctl.h>
 #include <linux/ptrace.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
+#include "tracee_memory.h"
+#include "policy.h"
 
+/* Function prototypes */
+int install_syscall_filter (const POLICY *);
 
 int 
 main (int argc, char **argv)
 {
-    if (argc != 2) {
-        printf ("Usage: %s ./program-name\n", argv[0]);
+    if (!(argc == 2 || (argc == 4 && strcmp (argv[1], "-p") == 0))) {
+        printf ("Usage: %s [-p policy-file] ./program-name\n", argv[0]);
         exit (EXIT_FAILURE);
     }
+    char *program = argv[argc - 1];
+
+    /* Compile the policy before the child starts, so that its filter and 
+     * every decision below come from the same tables */
+    POLICY policy;
+    if (argc == 4) {
+        if (policy_load (&policy, argv[2]) == -1)
+            exit (EXIT_FAILURE);
+    }
+    else if (policy_compile (&policy, default_policy, "default policy") == -1)
+        exit (EXIT_FAILURE);
 
     /* Extract program name from command-line argument (without the ./) */
-    char *program_name = strrchr (argv[1], '/');
+    char *program_name = strrchr (program, '/');
     if (program_name != NULL)
         program_name++;
     else
-        program_name = argv[1];
+        program_name = program;
 
     pid_t pid;
     pid = fork ();
     switch (pid) {
         case -1: /* Error */
             perror ("fork");
+            policy_free (&policy);
             exit (EXIT_FAILURE);
 
         case 0: /* Child code */
             /* Set child up to be traced */
             ptrace (PTRACE_TRACEME, 0, 0, 0);
             printf ("Executing %s in child code\n", program_name);
-            execlp (argv[1], program_name, NULL);
+            /* Hand the system calls to check to the tracer from exec onwards */
+            if (install_syscall_filter (&policy) == -1)
+                exit (EXIT_FAILURE);
+            execlp (program, program_name, NULL);
             perror ("execlp");
             exit (EXIT_FAILURE);
     }
@@ -58,103 +96,209 @@ main (int argc, char **argv)
     /* Parent code. Wait till the child begins execution and is 
      * stopped by the ptrace signal, that is, synchronize with 
      * PTRACE_TRACEME. When wait() returns, the child will be 
-     * paused. */
-    waitpid (pid, 0, 0); 
+     * paused. The filter is in place, but the policed system calls 
+     * fail with ENOSYS until PTRACE_O_TRACESECCOMP is set below. */
+    int status;
+    pid_t guest = pid;
+    waitpid (guest, &status, 0); 
 
     /* Send a SIGKILL signal to the tracee if the tracer exits.  
      * This option is useful to ensure that tracees can never 
-     * escape the tracer's control.
+     * escape the tracer's control. Stop on the system calls that the
+     * seccomp filter returns SECCOMP_RET_TRACE for, and mark 
+     * system call stops so they can be told apart from signals. Stop 
+     * after each exec, which closes descriptors without a close(). 
+     * Trace every child and thread as well: they inherit the filter, 
+     * and their policed system calls fail with ENOSYS unless traced.
      */
-    ptrace (PTRACE_SETOPTIONS, pid, 0, PTRACE_O_EXITKILL);
-
-    /* Intercept and examine the system calls made by the tracee */
-    while (1) {
-        /* Wait for the tracee to begin the next system call */
-        ptrace (PTRACE_SYSCALL, pid, 0, 0);
-        waitpid (pid, 0, 0);
-
-        /* When wait() returns, the registers for the process that made the 
-         * system call are filled with the system call number and its 
-         * arguments. However, the kernel has not yet serviced this system 
-         * call. We can now gather the system call information. 
-         *
-         * On the x86-64 architecture, the following registers hold the 
-         * relevant information.
-         *
-         * rax: system call number. For internal kernel purposes, the system call 
-         *      number is stored in orig_rax rather than in rax.
-         * rdi, rsi, rdx, r10, r8, r9: Upto six arguments passed via registers (note ordering)
-         *
-         */
-        struct user_regs_struct regs;
-        ptrace (PTRACE_GETREGS, pid, 0, &regs);                         /* Read tracee registers into regs */
-        long syscall = regs.orig_rax;                                   /* System call number */
-         fprintf (stderr, "%ld (%ld, %ld, %ld, %ld, %ld, %ld)",\
-                 syscall,\
-                 (long) regs.rdi, (long) regs.rsi, (long) regs.rdx,\
-                 (long) regs.r10, (long) regs.r8, (long) regs.r9); 
-
-        /* Run the system call and stop on exiting the call */
-
-        if(syscall==2){ //if the syscall is an open call
-          if (regs.rsi==0){ //call is read only, treat as usual
-            printf("  Read only call executed.\n"); 
-                  ptrace (PTRACE_SYSCALL, pid, 0, 0);
-              } else if(regs.rsi==524288){//call is for system set up
-                ptrace (PTRACE_SYSCALL, pid, 0, 0);
-              } else{
-                //check to see if running in tmp
-                //call uses file in tmp
-                    unsigned char *c, *buffer; 
-                    long data;
-                    unsigned int idx, old_idx,new_idx;
-                    int contains_tmp=0;
-              /* Allocate space to store the contents of the buffer */
-                    buffer = (unsigned char *) malloc (sizeof (long));
-                    data = ptrace (PTRACE_PEEKDATA, pid, (void *) regs.rdi, 0);
-                    c = (unsigned char *) &data;
-                    old_idx=idx;
-                    for (int j = 0; j < sizeof (long); j++)
-                        buffer[idx++] = c[j];
-                        putc (buffer[idx], stderr);
-                    new_idx=idx;
-                    int i;
-                    //printf("  old idx is %d; new idx is%d\n",old_idx, new_idx);
-                    for(int j=old_idx; j<new_idx-2; j++){
-                          if(buffer[j]=='t' && buffer[j+1]=='m' && buffer[j+2]=='p'){
-                            contains_tmp=1;
-                          } }                     
-                        free ((void *) buffer);
-                        buffer = NULL; 
-                     if(contains_tmp){//if the file is created in tmp
-                       printf("  Create in tmp executed.\n");
-                       ptrace (PTRACE_SYSCALL, pid, 0, 0);
-                       contains_tmp=0;
-                     } else{
-                         printf("  Operation not permitted\n");
-                         ptrace (PTRACE_SYSCALL, pid, 0, 0);
-                         regs.rax = -EPERM; /* Operation not permitted */
-                         ptrace(PTRACE_SETREGS, pid, 0, &regs);
-                     }
-                          
-            }
-        } else {//call is not an open
-            ptrace (PTRACE_SYSCALL, pid, 0, 0);
+    ptrace (PTRACE_SETOPTIONS, guest, 0, PTRACE_O_EXITKILL | PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD
+            | PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE);
+
+    /* What is known of each tracee */
+    TRACEE_STATE *tracees = NULL;
+    if (tracee_state_add (&tracees, guest) == NULL) {
+        policy_free (&policy);
+        exit (EXIT_FAILURE);
+    }
+    tracees->attached = 1;              /* Its first stop was the one after exec */
+    int exit_status = EXIT_FAILURE;
+
+    /* Intercept and examine the system calls handed over by the filter, in 
+     * whichever tracee stops next. Each one is resumed once its stop is 
+     * handled, to the exit of the call it is in if its result is needed. */
+    ptrace (PTRACE_CONT, guest, 0, 0);
+    while (tracees != NULL) {
+        pid = waitpid (-1, &status, __WALL);
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+            perror ("waitpid");
+            break;
+        }
+
+        TRACEE_STATE *tracee = tracee_state_find (tracees, pid);
+        if (WIFEXITED (status) || WIFSIGNALED (status)) {
+            if (pid == guest)
+                exit_status = WIFEXITED (status) ? WEXITSTATUS (status) : EXIT_FAILURE;
+            if (tracee != NULL)
+                tracee_state_remove (tracee);
+            continue;
+        }
+        if (tracee == NULL) {
+            /* A new child or thread, stopped before its parent reported it */
+            tracee = tracee_state_add (&tracees, pid);
+            if (tracee == NULL) {
+                kill (pid, SIGKILL);
+                continue;
             }
-            waitpid (pid, 0, 0);
+        }
 
-        /* Get the result of the system call */
-        if (ptrace (PTRACE_GETREGS, pid, 0, &regs) == -1) {
-            if (errno == ESRCH) 
-                exit (regs.rdi);                                        /* System call was exit() or similar */
-            perror ("ptrace");
-            exit (EXIT_FAILURE);
+        int signal_to_deliver = 0;
+        unsigned long message;
+        if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_FORK << 8))
+            || status >> 8 == (SIGTRAP | (PTRACE_EVENT_VFORK << 8))
+            || status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))) {
+            /* Start remembering the new tracee, which begins stopped */
+            ptrace (PTRACE_GETEVENTMSG, pid, 0, &message);
+            if (tracee_state_find (tracees, (pid_t) message) == NULL
+                && tracee_state_add (&tracees, (pid_t) message) == NULL)
+                kill ((pid_t) message, SIGKILL);
+        }
+        else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXEC << 8))) {
+            /* A thread that calls exec takes over the thread group's pid */
+            ptrace (PTRACE_GETEVENTMSG, pid, 0, &message);
+            TRACEE_STATE *former = tracee_state_find (tracees, (pid_t) message);
+            if (former != NULL && former != tracee)
+                tracee_state_remove (former);
+            tracee->in_syscall = 0;
+            tracee_state_exec (tracee);
         }
+        else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8))) {
+            /* When wait() returns, the registers for the process that made the 
+             * system call are filled with the system call number and its 
+             * arguments. However, the kernel has not yet serviced this system 
+             * call. We can now gather the system call information. 
+             *
+             * On the x86-64 architecture, the following registers hold the 
+             * relevant information.
+             *
+             * rax: system call number. For internal kernel purposes, the system call 
+             *      number is stored in orig_rax rather than in rax.
+             * rdi, rsi, rdx, r10, r8, r9: Upto six arguments passed via registers (note ordering)
+             *
+             */
+            struct user_regs_struct regs;
+            ptrace (PTRACE_GETREGS, pid, 0, &regs);                     /* Read tracee registers into regs */
+            long syscall = regs.orig_rax;                               /* System call number */
 
-        /* Print result of system call */
-        printf (" = %ld\n", (long) regs.rax);
+            /* Decide the call from the access it asks for on its canonical path. 
+             * Calls that only keep the tracee's descriptors and working directory 
+             * up to date are not printed. */
+            int decision = policy_check (&policy, tracee, &regs, tracee->path, sizeof (tracee->path));
+            if (decision != POLICY_TRACK) {
+                if (tracee->path[0] != '\0')
+                    fprintf (stderr, "%ld (%ld, %ld, %ld, %ld, %ld, %ld)",\
+                             syscall,\
+                             (long) regs.rdi, (long) regs.rsi, (long) regs.rdx,\
+                             (long) regs.r10, (long) regs.r8, (long) regs.r9); 
+                if (decision == POLICY_ALLOW) {
+                    if (tracee->path[0] != '\0')
+                        printf ("  %s permitted\n", tracee->path);
+                }
+                else {
+                    /* Skip the system call: a number of -1 is not executed, and rax 
+                     * becomes its result */
+                    printf ("  %s: Operation not permitted\n", tracee->path);
+                    regs.orig_rax = -1;
+                    regs.rax = -EPERM; /* Operation not permitted */
+                    ptrace (PTRACE_SETREGS, pid, 0, &regs);
+                }
+
+                /* Run the system call and stop on exiting the call */
+                tracee->in_syscall = 1;
+            }
+        }
+        else if (WSTOPSIG (status) == (SIGTRAP | 0x80) && tracee->in_syscall) {
+            /* Exit of the call: get its result */
+            struct user_regs_struct regs;
+            tracee->in_syscall = 0;
+            if (ptrace (PTRACE_GETREGS, pid, 0, &regs) == 0) {
+                /* Remember descriptors it opened, and print result of system call */
+                policy_record (&policy, tracee, tracee->path, (long) regs.rax);
+                if (tracee->path[0] != '\0')
+                    printf (" = %ld\n", (long) regs.rax);
+            }
+        }
+        else if (status >> 16 == 0 && WSTOPSIG (status) != (SIGTRAP | 0x80)) {
+            /* A signal for the tracee, SIGSTOP and SIGTRAP included, is passed 
+             * on. Not so the SIGSTOP that a new tracee starts with, nor a 
+             * group-stop, which PTRACE_GETSIGINFO fails on: the signal that 
+             * caused it was delivered already. */
+            siginfo_t info;
+            if (WSTOPSIG (status) == SIGSTOP && !tracee->attached)
+                tracee->attached = 1;
+            else if (ptrace (PTRACE_GETSIGINFO, pid, 0, &info) == 0)
+                signal_to_deliver = WSTOPSIG (status);
+        }
+
+        ptrace (tracee->in_syscall ? PTRACE_SYSCALL : PTRACE_CONT, pid, 0, signal_to_deliver);
     }
 
-    exit (EXIT_SUCCESS);
+    while (tracees != NULL)
+        tracee_state_remove (tracees);
+    policy_free (&policy);
+    exit (exit_status);
 }
 
+/* Install a seccomp filter in the calling process built from the policy's 
+ * system call table: SECCOMP_RET_TRACE for the calls to check or track, so 
+ * that they stop at the tracer, EPERM for the denied ones, and SECCOMP_RET_ALLOW for 
+ * every other call. System calls made through another ABI are killed, since 
+ * their numbers mean different calls. Returns 0 on success and -1 on error. */
+int
+install_syscall_filter (const POLICY *policy)
+{
+    /* Six statements check the architecture and load the number, each system 
+     * call takes two, and the last one allows the rest */
+    struct sock_filter filter[6 + 2 * POLICY_MAX_SYSCALL + 1];
+    int length = 0;
+
+    filter[length++] = (struct sock_filter) BPF_STMT (BPF_LD | BPF_W | BPF_ABS, offsetof (struct seccomp_data, arch));
+    filter[length++] = (struct sock_filter) BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0);
+    filter[length++] = (struct sock_filter) BPF_STMT (BPF_RET | BPF_K, SECCOMP_RET_KILL);
+    filter[length++] = (struct sock_filter) BPF_STMT (BPF_LD | BPF_W | BPF_ABS, offsetof (struct seccomp_data, nr));
+    filter[length++] = (struct sock_filter) BPF_JUMP (BPF_JMP | BPF_JGE | BPF_K, __X32_SYSCALL_BIT, 0, 1);
+    filter[length++] = (struct sock_filter) BPF_STMT (BPF_RET | BPF_K, SECCOMP_RET_KILL);
+
+    /* One compare per system call that is not simply allowed */
+    for (int number = 0; number < POLICY_MAX_SYSCALL; number++) {
+        if (policy->action[number] == POLICY_ALLOW)
+            continue;
+        filter[length++] = (struct sock_filter) BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, number, 0, 1);
+        filter[length++] = (struct sock_filter) BPF_STMT (BPF_RET | BPF_K, 
+                               (policy->action[number] == POLICY_DENY) ? SECCOMP_RET_ERRNO | (EPERM & SECCOMP_RET_DATA) 
+                               : SECCOMP_RET_TRACE);
+    }
+    filter[length++] = (struct sock_filter) BPF_STMT (BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+    if (length > BPF_MAXINSNS) {
+        fprintf (stderr, "Seccomp filter of %d statements is too long\n", length);
+        return -1;
+    }
+
+    struct sock_fprog program = {
+        .len = (unsigned short) length,
+        .filter = filter,
+    };
+
+    /* Lets an unprivileged process install the filter */
+    if (prctl (PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) {
+        perror ("prctl");
+        return -1;
+    }
+    if (prctl (PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program) == -1) {
+        perror ("prctl");
+        return -1;
+    }
+
+    return 0;
+}
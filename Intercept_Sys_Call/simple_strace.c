@@ -4,7 +4,7 @@
  * Author: Naga Kandasamy
  * Date created: February 20, 2020
  *
- * Compile as follows: gcc -o simple_strace simple_strace.c -std=99 -Wall 
+ * Compile as follows: gcc -o simple_strace simple_strace.c tracee_memory.c -std=c99 -Wall 
  * Execute as follows: ./simple_strace ./program-name 
  * The tracee program is in the same directory as your simple_strace program.
  *
@@ -27,6 +27,8 @@
 #include <sys/ptrace.h>
 #include <linux/ptrace.h>
 
+#include "tracee_memory.h"
+
 int 
 main (int argc, char **argv)
 {
@@ -97,6 +99,13 @@ main (int argc, char **argv)
                 (long) regs.rdi, (long) regs.rsi, (long) regs.rdx,\
                 (long) regs.r10, (long) regs.r8, (long) regs.r9);
 
+        /* Show the path named by open() and openat(), read from the tracee's memory */
+        char path[TRACEE_PATH_MAX];
+        if (syscall == SYS_open && tracee_read_string (pid, regs.rdi, path, sizeof (path)) >= 0)
+            fprintf (stderr, " \"%s\"", path);
+        else if (syscall == SYS_openat && tracee_read_string (pid, regs.rsi, path, sizeof (path)) >= 0)
+            fprintf (stderr, " \"%s\"", path);
+
         /* Run the system call and stop on exiting the call */
         ptrace (PTRACE_SYSCALL, pid, 0, 0);
         waitpid (pid, 0, 0);
@@ -0,0 +1,240 @@
+/* Access to the memory of a stopped tracee; see tracee_memory.h.
+ *
+ * Compile together with the program that uses it, for example:
+ * gcc -o simple_strace simple_strace.c tracee_memory.c -std=c99 -Wall
+ */
+
+#define _GNU_SOURCE                     /* process_vm_readv (), process_vm_writev () */
+
+/* Includes from the C standard library */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+/* POSIX includes */
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Linux includes */
+#include <sys/ptrace.h>
+
+#include "tracee_memory.h"
+
+/* Initial capacity of a scratch buffer, doubled until a request fits */
+#define TRACEE_BUFFER_MIN 4096
+
+/* Set once process_vm_readv () or process_vm_writev () turns out to be 
+ * unavailable to this process, after which every read goes through 
+ * PTRACE_PEEKDATA, or every write through PTRACE_POKEDATA */
+static int vm_readv_unavailable = 0;
+static int vm_writev_unavailable = 0;
+
+/* Make room for size bytes in buffer, keeping its capacity for later calls.
+ * Returns the data, or NULL if it cannot grow. */
+unsigned char *
+tracee_buffer_reserve (TRACEE_BUFFER *buffer, size_t size)
+{
+    if (size > buffer->capacity) {
+        size_t capacity = (buffer->capacity > 0) ? buffer->capacity : TRACEE_BUFFER_MIN;
+        while (capacity < size)
+            capacity *= 2;
+        unsigned char *data = (unsigned char *) realloc (buffer->data, capacity);
+        if (data == NULL) {
+            perror ("realloc");
+            return NULL;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+
+    return buffer->data;
+}
+
+/* Release the scratch buffer */
+void
+tracee_buffer_free (TRACEE_BUFFER *buffer)
+{
+    free ((void *) buffer->data);
+    buffer->data = NULL;
+    buffer->capacity = 0;
+}
+
+/* Copy count bytes at address with PTRACE_PEEKDATA, one aligned word at a
+ * time, so that no word straddles into the next page. Returns 0 on success
+ * and -1 if a word cannot be read. */
+static int
+peek_range (pid_t pid, unsigned long address, unsigned char *dst, size_t count)
+{
+    while (count > 0) {
+        unsigned long word_address = address & ~(unsigned long) (sizeof (long) - 1);
+        size_t skip = address - word_address;
+        size_t n = sizeof (long) - skip;
+        if (n > count)
+            n = count;
+
+        errno = 0;
+        long data = ptrace (PTRACE_PEEKDATA, pid, (void *) word_address, 0);
+        if (errno != 0)
+            return -1;
+        memcpy (dst, (unsigned char *) &data + skip, n);
+
+        address += n;
+        dst += n;
+        count -= n;
+    }
+
+    return 0;
+}
+
+/* Copy count bytes of the tracee's memory at address into dst. Whole ranges
+ * are read with process_vm_readv (); a page it cannot read is read with
+ * PTRACE_PEEKDATA instead. Returns the number of bytes copied, which is less
+ * than count only if some page cannot be read either way, or -1 if none can. */
+ssize_t
+tracee_read (pid_t pid, unsigned long address, void *dst, size_t count)
+{
+    unsigned char *out = (unsigned char *) dst;
+    size_t page = sysconf (_SC_PAGESIZE);
+    size_t done = 0;
+
+    while (done < count) {
+        if (!vm_readv_unavailable) {
+            struct iovec local = { out + done, count - done };
+            struct iovec remote = { (void *) (address + done), count - done };
+            ssize_t n = process_vm_readv (pid, &local, 1, &remote, 1, 0);
+            if (n > 0) {
+                done += n;
+                continue;
+            }
+            if (errno == ENOSYS || errno == EPERM)
+                vm_readv_unavailable = 1;
+        }
+
+        /* Read up to the end of the page that process_vm_readv () stopped at */
+        size_t stop = ((address + done) / page + 1) * page - address;
+        if (stop > count)
+            stop = count;
+        if (peek_range (pid, address + done, out + done, stop - done) == -1)
+            return (done > 0) ? (ssize_t) done : -1;
+        done = stop;
+    }
+
+    return done;
+}
+
+/* Copy count bytes from src to address with PTRACE_POKEDATA, one aligned 
+ * word at a time. A word only partly covered at either end of the range is 
+ * read first and merged, so the bytes around the range are left as they 
+ * were. Returns 0 on success and -1 if a word cannot be written. */
+static int
+poke_range (pid_t pid, unsigned long address, const unsigned char *src, size_t count)
+{
+    while (count > 0) {
+        unsigned long word_address = address & ~(unsigned long) (sizeof (long) - 1);
+        size_t skip = address - word_address;
+        size_t n = sizeof (long) - skip;
+        if (n > count)
+            n = count;
+
+        long data = 0;
+        if (n < sizeof (long)) {
+            errno = 0;
+            data = ptrace (PTRACE_PEEKDATA, pid, (void *) word_address, 0);
+            if (errno != 0)
+                return -1;
+        }
+        memcpy ((unsigned char *) &data + skip, src, n);
+        if (ptrace (PTRACE_POKEDATA, pid, (void *) word_address, (void *) data) == -1)
+            return -1;
+
+        address += n;
+        src += n;
+        count -= n;
+    }
+
+    return 0;
+}
+
+/* Copy count bytes from src into the tracee's memory at address. Whole ranges 
+ * are written with process_vm_writev (); a page it cannot write, such as a 
+ * read-only one, is written with PTRACE_POKEDATA instead, which the kernel 
+ * allows a tracer. Returns the number of bytes copied, which is less than 
+ * count only if some page cannot be written either way, or -1 if none can. */
+ssize_t
+tracee_write (pid_t pid, unsigned long address, const void *src, size_t count)
+{
+    const unsigned char *in = (const unsigned char *) src;
+    size_t page = sysconf (_SC_PAGESIZE);
+    size_t done = 0;
+
+    while (done < count) {
+        if (!vm_writev_unavailable) {
+            struct iovec local = { (void *) (in + done), count - done };
+            struct iovec remote = { (void *) (address + done), count - done };
+            ssize_t n = process_vm_writev (pid, &local, 1, &remote, 1, 0);
+            if (n > 0) {
+                done += n;
+                continue;
+            }
+            if (errno == ENOSYS || errno == EPERM)
+                vm_writev_unavailable = 1;
+        }
+
+        /* Write up to the end of the page that process_vm_writev () stopped at */
+        size_t stop = ((address + done) / page + 1) * page - address;
+        if (stop > count)
+            stop = count;
+        if (poke_range (pid, address + done, in + done, stop - done) == -1)
+            return (done > 0) ? (ssize_t) done : -1;
+        done = stop;
+    }
+
+    return done;
+}
+
+/* Read count bytes at address into the scratch buffer, followed by a NUL so
+ * that text can be handled as a string. Returns the buffer's data, valid
+ * until the next call with the same buffer, or NULL if the range cannot be
+ * read in full. */
+unsigned char *
+tracee_read_buffer (pid_t pid, unsigned long address, size_t count, TRACEE_BUFFER *buffer)
+{
+    if (tracee_buffer_reserve (buffer, count + 1) == NULL)
+        return NULL;
+    if (count > 0 && tracee_read (pid, address, buffer->data, count) != (ssize_t) count)
+        return NULL;
+    buffer->data[count] = '\0';
+    return buffer->data;
+}
+
+/* Read the NUL-terminated string at address into dst, which holds size bytes.
+ * The string is read a page at a time so that a string ending just before an
+ * unmapped page is still read. Returns the length of the string, or -1 if it
+ * cannot be read or does not fit. */
+ssize_t
+tracee_read_string (pid_t pid, unsigned long address, char *dst, size_t size)
+{
+    size_t page = sysconf (_SC_PAGESIZE);
+    size_t done = 0;
+    if (size == 0)
+        return -1;
+
+    while (done < size - 1) {
+        size_t chunk = page - (address + done) % page;
+        if (chunk > size - 1 - done)
+            chunk = size - 1 - done;
+        ssize_t n = tracee_read (pid, address + done, dst + done, chunk);
+        if (n <= 0)
+            break;
+
+        char *nul = (char *) memchr (dst + done, '\0', n);
+        if (nul != NULL)
+            return nul - dst;
+        done += n;
+    }
+
+    dst[done] = '\0';
+    return -1;
+}
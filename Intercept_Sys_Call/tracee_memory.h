@@ -0,0 +1,36 @@
+/* Access to the memory of a stopped tracee, shared by intercept_syscalls,
+ * simple_strace and sandbox.
+ *
+ * Ranges are copied with process_vm_readv () and process_vm_writev (), one
+ * system call for the whole range rather than one PTRACE_PEEKDATA or
+ * PTRACE_POKEDATA per word. Only pages that these cannot reach are retried a
+ * word at a time with ptrace ().
+ *
+ * Compile together with the program that uses it, for example:
+ * gcc -o simple_strace simple_strace.c tracee_memory.c -std=c99 -Wall
+ */
+
+#ifndef TRACEE_MEMORY_H
+#define TRACEE_MEMORY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Longest path read from a tracee, including the terminating NUL */
+#define TRACEE_PATH_MAX 4096
+
+/* Scratch buffer that grows as needed and is reused across system calls,
+ * so that reading a tracee's buffer does not allocate every time */
+typedef struct tracee_buffer_t {
+    unsigned char *data;
+    size_t capacity;                    /* Bytes allocated at data */
+} TRACEE_BUFFER;
+
+unsigned char *tracee_buffer_reserve (TRACEE_BUFFER *, size_t);
+void tracee_buffer_free (TRACEE_BUFFER *);
+ssize_t tracee_read (pid_t, unsigned long, void *, size_t);
+ssize_t tracee_write (pid_t, unsigned long, const void *, size_t);
+unsigned char *tracee_read_buffer (pid_t, unsigned long, size_t, TRACEE_BUFFER *);
+ssize_t tracee_read_string (pid_t, unsigned long, char *, size_t);
+
+#endif /* TRACEE_MEMORY_H */